@@ -6,6 +6,8 @@
 #include <comp421/yalnix.h>
 #include <comp421/hardware.h>
 
+#include "spawn.h"
+
 int
 main(int argc, char **argv)
 {
@@ -57,19 +59,14 @@ main(int argc, char **argv)
 	while ((cmd_argv[j++] = strtok(NULL, separators)) != NULL)
 	    ;
 
-	pid = Fork();
+	/* A child that cannot load the program exits with status ERROR */
+	pid = Spawn(cmd_argv[0], cmd_argv);
 
 	if (pid < 0) {
-	    TtyPrintf(termno, "Cannot Fork process\n");
+	    TtyPrintf(termno, "Cannot Spawn `%s'\n", cmd_argv[0]);
 	    continue;
 	}
 
-	if (pid == 0) {
-	    Exec(cmd_argv[0], cmd_argv);
-	    TtyPrintf(termno, "Could not Exec `%s'\n", cmd_argv[0]);
-	    Exit(1);
-	}
-
 	pid2 = Wait(&status);
 	if (pid2 < 0) {
 	    TtyPrintf(termno, "Wait returned error!\n");
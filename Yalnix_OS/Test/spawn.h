@@ -0,0 +1,34 @@
+#ifndef _spawn_h
+#define _spawn_h
+
+/*
+ * User-level stub for the Spawn kernel call, which the comp421 library does
+ * not provide. It traps into the kernel the same way the library's own
+ * kernel call stubs do: the call code goes in the first register, the
+ * arguments in the next ones, and the result comes back in the first.
+ * Spawn(file, argv) starts a child running file with argv, like Fork
+ * followed by Exec in the child, and returns the child's pid (or ERROR).
+ * If the file cannot be loaded, the child exits with status ERROR.
+ *
+ * The trap sequence has not been checked against the library's stubs, so
+ * only Test/shell and Test/spawntest use it; Test/init, which every
+ * terminal depends on, still uses Fork and Exec.
+ */
+
+// Must match YALNIX_SPAWN in the kernel's function.h.
+#define YALNIX_SPAWN 40
+
+static int
+Spawn(char *filename, char **argvec)
+{
+    int result;
+
+    __asm__ volatile ("int $0x80"
+	: "=a" (result)
+	: "a" (YALNIX_SPAWN), "b" (filename), "c" (argvec)
+	: "memory");
+
+    return (result);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+
+#include "spawn.h"
+
+/*
+ * spawntest: Spawns itself with the argument "child" and Waits for it, then
+ * Spawns a program that does not exist and checks that the child exits
+ * with status ERROR.
+ */
+int
+main(int argc, char **argv)
+{
+    char *child_argv[3];
+    char *missing_argv[2];
+    int pid, pid2;
+    int status;
+
+    setbuf(stdout, NULL);
+
+    if (argc > 1 && strcmp(argv[1], "child") == 0) {
+	printf("SPAWN> CHILD pid %d running '%s %s', exiting with 4321\n",
+	    GetPid(), argv[0], argv[1]);
+	Exit(4321);
+    }
+
+    child_argv[0] = "Test/spawntest";
+    child_argv[1] = "child";
+    child_argv[2] = NULL;
+
+    pid = Spawn(child_argv[0], child_argv);
+    printf("SPAWN> PARENT: Spawn returned pid %d\n", pid);
+    if (pid < 0) {
+	printf("SPAWN!! Spawn failed\n");
+	Exit(1);
+    }
+
+    pid2 = Wait(&status);
+    printf("SPAWN> Wait returned pid %d status %d\n", pid2, status);
+    if (pid2 != pid || status != 4321) {
+	printf("SPAWN!! Should have returned pid %d status 4321!!\n", pid);
+	Exit(1);
+    }
+
+    missing_argv[0] = "Test/no_such_program";
+    missing_argv[1] = NULL;
+
+    pid = Spawn(missing_argv[0], missing_argv);
+    printf("SPAWN> Spawn of a missing program returned pid %d\n", pid);
+    if (pid >= 0) {
+	pid2 = Wait(&status);
+	printf("SPAWN> Wait returned pid %d status %d\n", pid2, status);
+	if (pid2 != pid || status != ERROR) {
+	    printf("SPAWN!! Should have returned pid %d status %d!!\n",
+		pid, ERROR);
+	    Exit(1);
+	}
+    }
+
+    printf("SPAWN> GOOD!\n");
+    Exit(0);
+}
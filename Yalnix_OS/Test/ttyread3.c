@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+#include <comp421/hardware.h>
+
+#define	TTY_WRITE_STR(term, str) TtyWrite(term, str, strlen(str))
+
+char buf[8 * TERMINAL_MAX_LINE];
+
+/* Returns the number of newlines in the first len bytes of buf. */
+int
+CountLines(int len)
+{
+    int i;
+    int lines = 0;
+
+    for (i = 0; i < len; i++) {
+	if (buf[i] == '\n')
+	    lines++;
+    }
+    return (lines);
+}
+
+/*
+ * ttyread3: Exercises the terminal input ring on terminal 0. Follow the
+ * prompts there; results go to stderr.
+ */
+int
+main()
+{
+    int len;
+    int i;
+
+    /* Several lines typed before the read come back from one TtyRead. */
+    TTY_WRITE_STR(0, "Type three lines within 5 seconds\n");
+    Delay(5);
+    len = TtyRead(0, buf, sizeof(buf));
+    fprintf(stderr, "Read %d bytes, %d lines (expected 3 lines)\n",
+	len, CountLines(len));
+
+    /* A line longer than the buffer is returned a piece at a time. */
+    TTY_WRITE_STR(0, "Type a line of 10 or more characters\n");
+    len = TtyRead(0, buf, 4);
+    fprintf(stderr, "First read of 4 returned %d: '%.*s'\n", len, len, buf);
+    len = TtyRead(0, buf, 4);
+    fprintf(stderr, "Second read of 4 returned %d: '%.*s'\n", len, len, buf);
+    len = TtyRead(0, buf, sizeof(buf));
+    fprintf(stderr, "Rest of the line: %d bytes, ending in a newline: %s\n",
+	len, (len > 0 && buf[len - 1] == '\n') ? "yes" : "NO");
+
+    /* An empty line (end of input) is returned on its own, as 0. */
+    TTY_WRITE_STR(0, "Within 5 seconds type a line, then Ctrl-D, then another line\n");
+    Delay(5);
+    for (i = 0; i < 3; i++) {
+	len = TtyRead(0, buf, sizeof(buf));
+	fprintf(stderr, "Read %d returned %d bytes, %d lines (expected 1, 0, 1 lines)\n",
+	    i, len, CountLines(len));
+    }
+
+    /* Lines that do not fit in the ring are dropped and counted. */
+    TTY_WRITE_STR(0, "Within 10 seconds paste 70 or more short lines\n");
+    Delay(10);
+    len = TtyRead(0, buf, sizeof(buf));
+    fprintf(stderr, "Read %d bytes, %d lines (at most 64 are kept)\n",
+	len, CountLines(len));
+    fprintf(stderr, "The dropped lines are counted under 'Terminal input' when the kernel halts\n");
+
+    Exit(0);
+}
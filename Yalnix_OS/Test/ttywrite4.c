@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/yalnix.h>
+#include <comp421/hardware.h>
+
+#define	LONG_LINES	128
+#define	LINE_LEN	64
+
+char big[LONG_LINES * LINE_LEN + 1];	/* + 1 for sprintf's '\0' */
+char line[TERMINAL_MAX_LINE];
+
+/*
+ * ttywrite4: A write many lines long races a forked writer. The long write
+ * should come out on terminal 0 in one piece, with the child's lines before
+ * or after it but never in the middle. Then a write whose buffer runs past
+ * the break should return the part that was readable.
+ */
+int
+main()
+{
+    int i;
+    int pid;
+    int len;
+    int status;
+    char *top;
+
+    for (i = 0; i < LONG_LINES; i++) {
+	sprintf(big + i * LINE_LEN, "Parent long write line %3d %*s\n",
+	    i, LINE_LEN - 28, "");
+	memset(big + i * LINE_LEN + 27, '=', LINE_LEN - 28);
+    }
+
+    if ((pid = Fork()) < 0) {
+	fprintf(stderr, "Can't Fork!\n");
+	Exit(1);
+    }
+
+    if (pid == 0) {
+	for (i = 0; i < 10; i++) {
+	    sprintf(line, "Child line %d\n", i);
+	    TtyWrite(0, line, strlen(line));
+	}
+	Exit(0);
+    }
+
+    len = TtyWrite(0, big, LONG_LINES * LINE_LEN);
+    fprintf(stderr, "Long TtyWrite returned %d (expected %d)\n",
+	len, LONG_LINES * LINE_LEN);
+
+    Wait(&status);
+
+    /*
+     *  Grow the heap to a page boundary and write from a buffer that
+     *  starts 6000 bytes below the break and runs 6000 bytes past it.
+     */
+    top = (char *)UP_TO_PAGE(sbrk(0)) + 2 * PAGESIZE;
+    if (Brk(top)) {
+	fprintf(stderr, "Brk %p returned error\n", top);
+	Exit(1);
+    }
+    for (i = 0; i < 6000; i++)
+	top[i - 6000] = (i % LINE_LEN == LINE_LEN - 1) ? '\n' : '-';
+
+    len = TtyWrite(0, top - 6000, 12000);
+    fprintf(stderr, "TtyWrite past the break returned %d (expected 1 to 6000)\n",
+	len);
+    if (len <= 0 || len > 6000)
+	fprintf(stderr, "ttywrite4!! partial write returned the wrong length\n");
+
+    Exit(0);
+}
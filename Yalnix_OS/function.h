@@ -41,39 +41,234 @@ extern PCB* SearchAndReturnPCB(LinkedList* list, int pid);
 extern void printLinkedList(LinkedList* list);
 /* *************************** Linked List *************************** */
 
-// Physical frame struct.
-typedef struct pframe {
-    unsigned long frame_num; // Frame number of the physical frame
-    struct pframe* next; // Pointer to next free physical frame
-} pframe;
-
-typedef struct textStruct {
-    char line[TERMINAL_MAX_LINE];
-    int length; // Record the lenght of line that has not been read
-    int ptr; // Record the index in the line where it has not been read
-} textStruct;
+/* *************************** PCB Queue *************************** */
+// FIFO of PCBs linked through fields inside the PCB itself, so moving a process between queues never allocates.
+typedef struct PCBQueue {
+    PCB* head;                 // Pointer to the first PCB in the queue
+    PCB* tail;                 // Pointer to the last PCB in the queue
+} PCBQueue;
+
+// Function prototypes
+extern void enqueuePCB(PCBQueue* queue, PCB* pcb);
+extern PCB* dequeuePCB(PCBQueue* queue);
+extern PCB* peekPCB(PCBQueue* queue);
+extern void removePCB(PCB* pcb);
+extern int IsPCBQueueEmpty(PCBQueue* queue);
+extern void appendPCBQueue(PCBQueue* dst, PCBQueue* src);
+extern void addRunningChild(PCB* parent, PCB* child);
+extern void removeRunningChild(PCB* parent, PCB* child);
+/* *************************** PCB Queue *************************** */
+
+// Scheduling state of a process. A process is in at most one PCBQueue, matching its state.
+typedef enum ProcState {
+    PROC_RUNNING,    // Currently on the CPU (curr_proc)
+    PROC_READY,      // In readyQueue[priority]
+    PROC_DELAYED,    // In delay_heap
+    PROC_WAITING,    // In wait_queue, blocked in Wait
+    PROC_READING,    // In readQueue[tty], blocked in TtyRead
+    PROC_WRITING,    // In writeQueue[tty], blocked in TtyWrite until the terminal's output ring has room
+    PROC_TERMINATED  // Exited; freed on the next context switch
+} ProcState;
+
+/* *************************** Physical Frames *************************** */
+// Free frames are chained through their own first word, so the allocator needs no kernel heap.
+// The kernel reads and writes frames (those links, copies, zeroing) through a few mapping slots at the
+// top of region 1. KMap maps a frame into a slot, reusing a slot that already maps it.
+#define KMAP_SLOTS 4 // Number of mapping slots; at least two, to copy between frames
+#define KMAP_BASE (VMEM_1_LIMIT - KMAP_SLOTS * PAGESIZE) // Address of the first slot
+#define NO_FRAME (-1) // End of the free frame list
+
+// Software flag kept in the unused bits of a region 0 pte.
+#define PTE_COW 0x1 // Page was writable and is now shared read-only since Fork; copied on the first write
+#define PTE_FILE 0x2 // Invalid page not loaded yet; pfn holds its page number in the process's program image
+#define PTE_SWAP 0x4 // Invalid page written out to the swap file; pfn holds its swap slot
+#define PTE_UNREF 0x8 // Invalid page the swap clock is checking for use; pfn still holds its frame
+#define PTE_ZRAM 0x10 // Invalid page held compressed in kernel memory; pfn holds its entry in zram_entries
+// Pages that are all zero and never written (bss, heap, stack) map the read-only zero frame with PTE_COW set,
+// so the first write gets them a private frame.
+
+// Free frames zeroed ahead of time while the idle process runs, for allocations that need a zeroed frame.
+#define ZERO_POOL_SIZE 16 // Most frames kept zeroed
+#define ZERO_POOL_BATCH 4 // Most frames zeroed per clock tick spent idle
+/* *************************** Physical Frames *************************** */
+
+/* *************************** Swap *************************** */
+// Cold user pages are written to a file on the host when the frames run out, and read back when touched.
+#define SWAP_FILE_NAME "yalnix.swap" // Host file holding swapped-out pages, created at boot
+#define SWAP_SLOTS 1024 // Number of page-sized slots in the swap file
+#define SWAP_BATCH 8 // Most pages written out by one call to ReclaimFrames
+/* *************************** Swap *************************** */
+
+/* *************************** Compressed Store *************************** */
+// Before anything goes to the swap file, pages of processes blocked a long time are compressed into frames
+// kept by the kernel, packed one after another.
+#define ZRAM_MAX_ENTRIES 512 // Most pages held compressed
+#define ZRAM_POOL_FRAMES 64 // Most frames holding compressed pages
+#define ZRAM_MAX_LEN (PAGESIZE / 2) // Pages that do not compress to this many bytes are left for the swap file
+#define ZRAM_IDLE_TICKS 5 // Clock ticks a process must have been blocked before its pages are compressed
+
+// A compressed page.
+typedef struct ZramEntry {
+    int frame; // Index in zram_pool of the frame holding it
+    unsigned short offset; // Where it starts in that frame
+    unsigned short len; // Compressed length in bytes
+    unsigned int refcount; // Number of page table entries referring to it, 0 if the entry is free
+} ZramEntry;
+
+// A frame holding compressed pages. It is freed once none of them is live; space is not reused before then.
+typedef struct ZramFrame {
+    long pfn; // Frame number, NO_FRAME if this pool slot is unused
+    int used; // Bytes filled from the start of the frame
+    int live; // Number of live entries in the frame
+} ZramFrame;
+/* *************************** Compressed Store *************************** */
+
+/* *************************** Same-Page Merging *************************** */
+// While the idle process runs, identical private user pages of different processes (or of one) are merged into
+// one read-only copy-on-write frame.
+#define KSM_SCAN_BATCH 32 // Most pages hashed per clock tick spent idle
+#define KSM_TABLE_SIZE 256 // Number of entries in ksm_table
+
+// The last page seen with a given hash, which a later page with the same bytes can be merged with.
+typedef struct KsmEntry {
+    unsigned long hash; // Hash of the page's bytes when it was recorded
+    long pfn; // Its frame, NO_FRAME if the entry is empty
+    int owner_pid; // Process that mapped it, checked to still map it before the frame is trusted
+    unsigned long owner_vpn; // Region 0 page it was mapped at
+} KsmEntry;
+/* *************************** Same-Page Merging *************************** */
+
+/* *************************** TLB *************************** */
+// Most pages of one region flushed one at a time by TLBFlushPending; past this a single region flush is cheaper.
+#define TLB_BATCH_LIMIT 8
+/* *************************** TLB *************************** */
+
+/* *************************** Page Table Pool *************************** */
+// Region 0 page tables take half a page each and live in region 1 just below the kernel mapping slots.
+// The unused bits of a region 1 pte mapping a page table page record which halves are in use.
+#define PGT_HALF_LO 0x1 // Lower half of the page holds a page table
+#define PGT_HALF_HI 0x2 // Upper half of the page holds a page table
+
+// A free half-page slot, linked into the pool's free list through the slot itself.
+typedef struct PageTableSlot {
+    struct PageTableSlot *next;
+    struct PageTableSlot *prev;
+} PageTableSlot;
+/* *************************** Page Table Pool *************************** */
+
+/* *************************** Terminal Input *************************** */
+// Received lines are kept in a fixed ring per terminal, with the length of each line alongside, so receiving a
+// line allocates nothing and the input a terminal can hold is bounded.
+#define TTY_IN_RING_SIZE (4 * TERMINAL_MAX_LINE) // Bytes of unread input a terminal can hold
+#define TTY_IN_MAX_LINES 64 // Unread lines a terminal can hold
+
+// What TrapReceiveHandler does with a line the ring has no room for. Either way the dropped lines are counted.
+#define TTY_IN_DROP_NEWEST 0 // Throw the new line away, keeping what was typed first
+#define TTY_IN_DROP_OLDEST 1 // Throw away the oldest lines until the new one fits
+#define TTY_IN_OVERFLOW TTY_IN_DROP_NEWEST
+
+typedef struct TtyInput {
+    char ring[TTY_IN_RING_SIZE]; // Received bytes not read yet
+    int head; // Index in ring of the oldest byte
+    int count; // Number of bytes in ring
+    int line_len[TTY_IN_MAX_LINES]; // Unread bytes of each buffered line, oldest first
+    int line_head; // Index in line_len of the oldest line
+    int lines; // Number of buffered lines
+    int wakeups; // Readers made ready for a line that have not run yet; that many lines are spoken for
+    char rx[TERMINAL_MAX_LINE]; // Where a line is received when the ring has no room for it without wrapping
+    unsigned long dropped_lines; // Lines thrown away because the ring was full
+    unsigned long dropped_bytes; // Bytes of those lines
+} TtyInput;
+/* *************************** Terminal Input *************************** */
+
+/* *************************** Terminal Output *************************** */
+// TtyWrite copies into a ring per terminal and returns; the transmit path drains the ring a line's worth at a time,
+// so small writes (from any process) go out together. Writers block only while the ring is nearly full. A write
+// longer than the ring is streamed through it, the writer waking each time it drains to the low water mark.
+#define TTY_OUT_RING_SIZE (4 * TERMINAL_MAX_LINE) // Bytes of output a terminal can hold before it is transmitted
+#define TTY_OUT_HIGH_WATER (3 * TERMINAL_MAX_LINE) // A writer blocks once the ring holds this much
+#define TTY_OUT_LOW_WATER TERMINAL_MAX_LINE // Blocked writers wake once the ring drains down to this
+
+typedef struct TtyOutput {
+    char ring[TTY_OUT_RING_SIZE]; // Bytes written but not transmitted yet
+    int head; // Index in ring of the oldest byte
+    int count; // Number of bytes in ring
+    char xmit[TERMINAL_MAX_LINE]; // Bytes being transmitted, taken from the ring when the transmit starts
+    PCB *streamer; // Process streaming a write longer than a line through the ring, NULL if none
+} TtyOutput;
+/* *************************** Terminal Output *************************** */
+
+/* *************************** Image Cache *************************** */
+// Bounds on the cache of program files kept in kernel memory. Region 1 is small, so these are too.
+#define IMAGE_CACHE_MAX_ENTRIES 8
+#define IMAGE_CACHE_MAX_BYTES (16 * PAGESIZE)
+
+// The header and text and data bytes of a program file, so Exec of a recently run program needs no file I/O.
+typedef struct ImageCacheEntry {
+    char *path; // Name the program was loaded by
+    unsigned long dev; // Device, inode, size and modification time of the file when it was cached
+    unsigned long ino;
+    unsigned long size;
+    long mtime;
+    struct loadinfo li; // Header read by LoadInfo
+    char *bytes; // Text followed by data
+    unsigned long nbytes; // Length of bytes
+    int users; // Number of program images reading pages from this entry; it is not evicted while in use
+    struct ImageCacheEntry *lru_prev; // Next more recently used entry
+    struct ImageCacheEntry *lru_next; // Next less recently used entry
+} ImageCacheEntry;
+/* *************************** Image Cache *************************** */
+
+/* *************************** Program Image *************************** */
+// The text and data of a loaded program, read into region 0 a page at a time as the process touches it.
+// Every process running the same file shares one image, found in image_registry by the file's identity,
+// and maps the same read-only text frames.
+typedef struct ProgramImage {
+    int fd; // Open program file the pages are read from, -1 if they come from cached
+    ImageCacheEntry *cached; // Image cache entry holding the text and data, NULL to read them from fd
+    unsigned long dev; // Device, inode, size and modification time of the file, which identify the image
+    unsigned long ino;
+    unsigned long size;
+    long mtime;
+    unsigned long file_offset; // File offset of the first byte of text
+    unsigned long file_size; // Bytes of text plus data in the file; bss and the rest of the last page are zero
+    unsigned long text_npg; // Number of text pages
+    long *text_pfn; // Frame holding each text page once some process has read it, NO_FRAME before
+    int refcount; // Number of processes whose page tables refer to this image
+    struct ProgramImage *next; // Next image in image_registry
+} ProgramImage;
+/* *************************** Program Image *************************** */
 
 /* *************************** Define PCB *************************** */
+#define USER_PAGES (PAGE_TABLE_LEN - KERNEL_STACK_PAGES) // Region 0 pages below the kernel stack
+#define PAGE_MAP_WORDS ((USER_PAGES + 31) / 32) // Words in a PCB's page_map
+
 struct PCB {
     int pid; // Process's ID
     int parent_pid; // Process's parent PID, -1 means an orphan process
-    struct PCB* parent; // PCB of parent. NULL if no parent.
     unsigned int runningTime; // Record the total # of clock ticks undergone by this process after most recent context switch
+    int priority; // MLFQ level this process runs/queues at, 0 is the highest priority
     unsigned int delay_until; // Records (if a process is delayed) what time it should delay until (compare with runningTime)
-    int needs_copy; // Flag that indicates whether this process (p1) should be copied to another (p2), 1 if Yes, -1 if No
-    int isDelayed; // Flag that indicates whether this process is delayed. 1 if Yes, -1 if No.
-    int isTerminated; // Flag that indicate whether this process should be terminated, 1 means Yes, -1 means No (do not terminate)
+    int needs_copy; // Flag that indicates whether this process (p1) should be copied to another (p2), 1 if Yes, -1 if No, 0 if the copy failed for lack of frames
+    ProcState state; // Scheduling state of this process, e.g. ready, delayed or terminated
+    unsigned long blocked_since; // total_runningTime when the process last blocked in Wait or TtyRead
+
+    struct PCB* q_next; // Next PCB in the PCBQueue holding this process
+    struct PCB* q_prev; // Previous PCB in the PCBQueue holding this process
+    PCBQueue* q_owner; // PCBQueue holding this process, NULL if in none
 
     LinkedList* exited_children; // FIFO for this process's children that exited but not yet collected by this process
-    LinkedList* running_children; // FIFO to record this process's running children
+    PCBQueue running_children; // FIFO to record this process's running children, linked through sibling_next/sibling_prev
+    struct PCB* sibling_next; // Next child in the parent's running_children
+    struct PCB* sibling_prev; // Previous child in the parent's running_children
 
     struct pte *pgt_r0; // Pointer to page table of region 0
     unsigned long pgt_r0_paddr; // Physical address to location of the next page table for region 0 (without offset)
     unsigned long brk; // Break of process heap - first memory address not part of heap.
     unsigned int uStack_bottom; // record the page table index for user stack that has range [uStack_bottom, uStack_top]
-
-    char* writeRequest; // Points to buffer containing the bytes passed to TtyWrite call
-    int writeLength; // Records length passed to a TtyWrite call
+    ProgramImage *image; // Program whose text and data pages are loaded on demand, NULL if none
+    unsigned int page_map[PAGE_MAP_WORDS]; // Bit i is set if user pte i is in use: valid, or tagged (PTE_FILE, PTE_SWAP, ...)
+    int resident_pages; // Number of user pages holding a frame other than the zero frame
 
     SavedContext *ctx; // saved context of CPU state
 };
@@ -85,19 +280,48 @@ struct exit_child_status {
 
 /* *************************** Define PCB *************************** */
 
+// System call code for Spawn, which comp421/yalnix.h does not define. Arguments are passed like Exec: regs[1] is
+// the file name and regs[2] the argv array. Returns the child's pid, or ERROR. User programs call it through the
+// stub in Test/spawn.h.
+#define YALNIX_SPAWN 40
+
 // Define the type of the function pointers
 typedef void (*InterruptHandler)(ExceptionInfo *);
 
+/* *************************** Scheduler *************************** */
+#define NUM_PRIORITY_LEVELS 4 // Number of MLFQ priority levels, 0 is the highest
+#define PRIORITY_BOOST_INTERVAL 50 // Clock ticks between boosts of every ready process back to level 0
+
+#define DELAY_HEAP_INIT_CAPACITY 16 // Initial number of slots in the delay heap; doubled whenever it fills up
+
+extern const unsigned int level_quantum[NUM_PRIORITY_LEVELS]; // Time slice (in clock ticks) for each level
+/* *************************** Scheduler *************************** */
+
+/* *************************** Process Table *************************** */
+// Maximum number of live processes. Must be a power of two: a pid is (generation * PROC_TABLE_SIZE + slot).
+#define PROC_TABLE_SIZE 256
+
+extern PCB* FindProcess(int pid);
+extern int InsertProcess(PCB *pcb);
+extern void RemoveProcess(PCB *pcb);
+/* *************************** Process Table *************************** */
+
 /* ######################## Global Variable ######################## */
 
-extern unsigned int pid_counter;
 extern PCB *curr_proc;  // Points to the current runnning process
-extern int is_half_used; // Flag variable to indicate if region 1 page table page is half used
 
-extern LinkedList* processQueue; // List of all processes 
-extern LinkedList* runningQueue; // FIFO queue for all ready-running processes
-extern LinkedList* delay_queue; // FIFO queue for all delayed processes
-extern LinkedList* wait_queue; // FIFO queue for all waiting processes
+extern PCB* proc_table[PROC_TABLE_SIZE]; // Live processes indexed by pid % PROC_TABLE_SIZE
+extern unsigned int proc_generation[PROC_TABLE_SIZE]; // Times each slot has been reused, the high part of the slot's next pid
+extern int proc_free_slots[PROC_TABLE_SIZE]; // FIFO ring of free slot indices, so a freed pid is reused as late as possible
+extern int proc_free_head; // Index in proc_free_slots of the next slot to hand out
+extern int proc_free_count; // Number of free slots in proc_free_slots
+extern int proc_table_count; // Number of live processes in proc_table, including idle
+extern PCBQueue readyQueue[NUM_PRIORITY_LEVELS]; // FIFO queue of ready processes for each MLFQ level
+extern unsigned int ready_bitmap; // Bit i is set if readyQueue[i] is non-empty
+extern PCB** delay_heap; // Min-heap of delayed processes keyed on delay_until
+extern int delay_heap_size; // Number of processes in delay_heap
+extern int delay_heap_capacity; // Number of slots allocated for delay_heap
+extern PCBQueue wait_queue; // FIFO queue for all waiting processes
 
 
 extern InterruptHandler *interruptVectorTable; // Contains interrupt vectors
@@ -107,8 +331,16 @@ extern int vm_enabled; // Flag to indicate if VM is enabled
 // Page Tables
 extern struct pte *pgt_r0;
 extern struct pte *pgt_r1;
-extern unsigned long addr_next_pgt_r0;
-extern unsigned long curr_pgt_paddr;
+extern unsigned long addr_next_pgt_r0; // Next page down to map for region 0 page tables when the pool runs out
+extern ProgramImage *image_registry; // Program images in use, one per program file
+extern ImageCacheEntry *image_cache_head; // Most recently used image cache entry
+extern ImageCacheEntry *image_cache_tail; // Least recently used image cache entry
+extern int image_cache_count; // Number of entries in the image cache
+extern unsigned long image_cache_bytes; // Text and data bytes held by the image cache
+extern unsigned long image_cache_hits; // Execs that found their program in the image cache
+extern unsigned long image_cache_misses; // Execs that had to open their program file
+extern PageTableSlot *pgt_free_head; // Free half-page slots in mapped page table pages
+extern unsigned long pgt_hole_head; // Region 1 page index of the first unmapped page in the page table area, 0 if none
 
 // Idle process's PCB
 extern PCB* idle_pcb;
@@ -116,17 +348,69 @@ extern PCB* idle_pcb;
 // Total program running time.
 extern unsigned long total_runningTime;
 
-// Physical frame head, and count.
-extern pframe *free_pframe_head;
+// Physical frame allocator: a list of freed frames, then frames never handed out yet, and the free count.
+extern long free_pframe_head; // Frame number of the first frame on the free list, NO_FRAME if empty
+extern unsigned long next_untouched_pfn; // Lowest frame number never handed out; every frame from here up is free
+extern unsigned long num_pframes; // Number of physical frames
+extern unsigned long kernel_reserved_lo; // First frame of the kernel stack and region 1 kernel image, never handed out
+extern unsigned long kernel_reserved_hi; // First frame above the kernel's reserved frames
+extern long kmap_pfn[KMAP_SLOTS]; // Frame mapped in each kernel mapping slot, NO_FRAME if none
+extern int kmap_pins[KMAP_SLOTS]; // Number of KMap callers using each slot; a pinned slot is never remapped
+extern unsigned long kmap_last_use[KMAP_SLOTS]; // Value of kmap_clock when each slot was last handed out
+extern unsigned long kmap_clock; // Count of KMap calls, to find the least recently used slot
+extern unsigned long kmap_hits; // KMap calls that found the frame already mapped
+extern unsigned long kmap_misses; // KMap calls that had to remap a slot
 extern int free_pframe_count;
+extern unsigned int *frame_refcount; // Number of page table entries mapping each allocated frame
+extern unsigned long tlb_pending[2][TLB_BATCH_LIMIT]; // Stale pages of region 0 and 1 not flushed yet
+extern int tlb_pending_count[2]; // Number of pages in tlb_pending for each region
+extern int tlb_pending_all[2]; // Set if the whole region needs flushing
+extern unsigned long tlb_pages_invalidated; // Pages recorded as stale
+extern unsigned long tlb_address_flushes; // Single-address flushes written to the hardware
+extern unsigned long tlb_region_flushes; // Whole-region (or whole-TLB) flushes written to the hardware
+extern unsigned long tlb_flushes_avoided; // Recorded invalidations that needed no flush of their own
+extern long zero_pfn; // Frame of zeros shared by every untouched zero page; not reference counted, never freed
+extern long zero_pool[ZERO_POOL_SIZE]; // Free frames already zeroed; counted in free_pframe_count, but not on the free list
+extern int zero_pool_count; // Number of frames in zero_pool
+extern unsigned long zero_pool_hits; // Zeroed frames handed out from the pool
+extern unsigned long zero_pool_misses; // Zeroed frames that had to be zeroed when allocated
+extern int swap_fd; // Open swap file, -1 if running without swap
+extern unsigned short *swap_slot_refcount; // Number of page table entries referring to each swap slot
+extern int swap_slots_used; // Number of swap slots in use
+extern int swap_slot_hint; // Slot AllocateSwapSlot looks at first
+extern int swap_hand_slot; // Process table slot the swap clock hand is at
+extern unsigned long swap_hand_vpn; // Region 0 page the swap clock hand is at
+extern unsigned long swap_outs; // Pages written to the swap file
+extern unsigned long swap_ins; // Pages read back from the swap file
+extern unsigned long swap_rescues; // Pages the swap clock checked that were used again before being written out
+extern unsigned long swap_in_usec; // Microseconds spent reading pages back from the swap file
+extern ZramEntry zram_entries[ZRAM_MAX_ENTRIES]; // Compressed pages
+extern ZramFrame zram_pool[ZRAM_POOL_FRAMES]; // Frames holding the compressed pages
+extern int zram_pool_count; // Number of frames in zram_pool
+extern int zram_stored_pages; // Number of pages held compressed
+extern unsigned long zram_stored_bytes; // Compressed bytes of the pages held
+extern unsigned long zram_stores; // Pages compressed
+extern unsigned long zram_rejected; // Pages that did not compress well enough to keep
+extern unsigned long zram_loads; // Pages decompressed on a fault
+extern unsigned long zram_load_usec; // Microseconds spent decompressing pages on faults
+extern KsmEntry ksm_table[KSM_TABLE_SIZE]; // Recorded pages by hash, for the merging scanner
+extern int ksm_hand_slot; // Process table slot the merging scanner is at
+extern unsigned long ksm_hand_vpn; // Region 0 page the merging scanner is at
+extern unsigned long ksm_pages_scanned; // Pages hashed by the merging scanner
+extern unsigned long ksm_bytes_compared; // Bytes compared to confirm hash matches
+extern unsigned long ksm_merges; // Pages merged with an identical page, each freeing a frame
+extern unsigned long ksm_zero_merges; // All-zero pages merged into the zero frame, each freeing a frame
+extern unsigned long ksm_scan_usec; // Microseconds spent scanning
 
 // Terminal related Data Structure
-extern LinkedList* inputBuffer[NUM_TERMINALS]; // Input buffer read for each terminal 
-extern int readReady[NUM_TERMINALS]; // Flag to indicate if terminal i has text available to read, -1 means not ready. 1 means ready.
+extern TtyInput inputRing[NUM_TERMINALS]; // Input received from terminal i and not read yet
 extern int writeReady[NUM_TERMINALS]; // Flag to indicate if terminal i is ready to be written, -1 means not ready. 1 means ready.
-extern LinkedList* readQueue[NUM_TERMINALS]; // Queue that stores the process's PCB for a read request on terminal i
-extern LinkedList* writeQueue[NUM_TERMINALS];// Queue that stores the process's PCB for a write request on terminal i
-extern PCB* transmitPCB[NUM_TERMINALS]; // Array that stores the PCB's of processes that called a TtyTransmit in HandleTtyWrite, and is waiting for trap handler to context switch back to confirm it finished successfully.
+extern PCBQueue readQueue[NUM_TERMINALS]; // Queue that stores the process's PCB for a read request on terminal i
+extern PCBQueue writeQueue[NUM_TERMINALS]; // Processes blocked in TtyWrite until terminal i's output ring drains
+extern TtyOutput outputRing[NUM_TERMINALS]; // Output written to terminal i and not transmitted yet
+extern unsigned long tty_writes; // TtyWrite calls copied into an output ring
+extern unsigned long tty_transmits; // TtyTransmit calls the output rings were drained with
+extern unsigned long tty_write_blocks; // Times a writer blocked on a full output ring
 
 
 /* ######################## Global Variable ######################## */
@@ -140,6 +424,8 @@ extern void initInterruptVector(void);
 extern void InitMemoryManagement(unsigned int pmem_size);
 extern void CreateIdleProcess(ExceptionInfo *info, char **cmd_args);
 extern void CreateInitProcess(ExceptionInfo *info, char **cmd_args);
+extern void HaltIfFinished();
+extern void PrintKernelStats();
 
 /* Helper function for ContextSwitch*/
 extern SavedContext *MySwitchFunc(SavedContext *ctxp, void *p1, void* p2);
@@ -151,6 +437,20 @@ extern void notifyChildren(PCB *pcb);
 extern void freeProcessResources(PCB *pcb);
 extern void scheduleNextProcess();
 
+/* MLFQ ready queue operations */
+extern void MakeProcessReady(PCB *pcb);
+extern PCB* PickNextReady();
+extern int HighestReadyPriority();
+extern void BoostPriority(PCB *pcb, int levels);
+extern void DemotePriority(PCB *pcb);
+extern void BoostAllReady();
+extern void UnreadyProcess(PCB *pcb);
+
+/* Delay heap operations */
+extern int DelayHeapInsert(PCB *pcb);
+extern PCB* DelayHeapPeek();
+extern PCB* DelayHeapPop();
+
 /* Trap handler functions */ 
 extern void TrapKernelHandler(ExceptionInfo *info);
 extern void TrapClockHandler(ExceptionInfo *info);
@@ -163,6 +463,7 @@ extern void TrapTransmitHandler(ExceptionInfo *info);
 /* Handler function for user's system call */ 
 extern int HandleFork(ExceptionInfo *info);
 extern int HandleExec(char *filename, char **argvec, ExceptionInfo *info);
+extern int HandleSpawn(char *filename, char **argvec, ExceptionInfo *info);
 extern void HandleExit(int status);
 extern int HandleWait(int *status_ptr);
 extern int HandleGetPid(void);
@@ -170,15 +471,80 @@ extern int HandleBrk(void *addr);
 extern int HandleDelay(int clock_ticks);
 extern int HandleTtyRead(int tty_id, void *buf, int len);
 extern int HandleTtyWrite(int tty_id, void *buf, int len);
+extern void StartTtyTransmit(int tty_id);
+extern int TtyInputMakeRoom(TtyInput *in, int n);
+extern void WakeTtyReaders(int tty_id);
 
 /* Helper functions for PCB creation.*/
 extern struct PCB* CreatePCB(PCB* parent);
 extern struct PCB* CreateIdlePCB();
+extern void DestroyUnstartedPCB(PCB *pcb);
 
 /* Handler function for Page Table operation*/ 
 extern void FreePhysicalPage(unsigned int pfn);
+extern long TakeFreeFrame();
 extern long AllocateFreePage();
+extern void *KMap(unsigned long pfn);
+extern void KUnmap(void *addr);
+extern void CopyFrame(unsigned long dst_pfn, unsigned long src_pfn);
+extern void ZeroFrame(unsigned long pfn);
+extern void ShareFrame(unsigned int pfn);
+
+/* Copy-on-write and user buffer helpers */
+extern int BreakCopyOnWrite(unsigned int vpn);
+extern void TLBInvalidate(unsigned long addr);
+extern void TLBInvalidateRegion(int region);
+extern void TLBFlushPending();
+extern void TLBFlushAddress(unsigned long addr);
+extern void TLBFlushRegion(int region);
+extern void InitZeroFrame();
+extern long AllocateZeroedPage();
+extern void RefillZeroPool();
+extern void MapZeroPage(unsigned long vpn);
+extern void MarkPageUsed(PCB *pcb, unsigned long vpn);
+extern void MarkPageUnused(PCB *pcb, unsigned long vpn);
+extern unsigned long NextUsedPage(PCB *pcb, unsigned long vpn);
+extern int FaultInPage(unsigned long vpn);
+extern void InitSwap();
+extern long AllocateSwapSlot();
+extern void ShareSwapSlot(unsigned int slot);
+extern void FreeSwapSlot(unsigned int slot);
+extern int ReclaimFrames();
+extern int EnsureFreeFrames(int n);
+extern int SwapInPage(unsigned long vpn);
+extern void ReleaseUserPage(PCB *pcb, unsigned long vpn);
+extern void InitZram();
+extern int CompressPage(const unsigned char *src, unsigned char *dst, int cap);
+extern void DecompressPage(const unsigned char *src, int len, unsigned char *dst);
+extern int ZramStorePage(PCB *pcb, unsigned long vpn);
+extern int ZramCompressIdle();
+extern void ShareZramEntry(unsigned int entry);
+extern void FreeZramEntry(unsigned int entry);
+extern int ZramLoadPage(unsigned long vpn);
+extern void InitKsm();
+extern unsigned long HashFrame(unsigned long pfn, int *is_zero);
+extern int SameFrame(unsigned long a, unsigned long b);
+extern void KsmProtectPage(struct pte *pte);
+extern int KsmMergePage(PCB *pcb, unsigned long vpn);
+extern void KsmScan();
+extern ProgramImage *GetProgramImage(int fd, ImageCacheEntry *cached, struct loadinfo *li);
+extern void ShareProgramImage(ProgramImage *image);
+extern ImageCacheEntry *LookupImageCache(char *path);
+extern ImageCacheEntry *AddImageCache(char *path, int fd, struct loadinfo *li);
+extern void PreloadImageCache(char *names);
+extern void EvictImageCacheEntry(ImageCacheEntry *entry);
+extern void PushImageCacheEntry(ImageCacheEntry *entry);
+extern void UnlinkImageCacheEntry(ImageCacheEntry *entry);
+extern void ReleaseProgramImage(ProgramImage *image);
+extern int PrepareUserAccess(void *addr, unsigned long len, int write);
+extern char *CopyUserString(char *str);
+extern char **CopyUserArgs(char **argvec);
+extern void FreeKernelArgs(char **args);
 extern int AllocateRegion0PageTable(PCB* pcb);
+extern void FreeRegion0PageTable(PCB* pcb);
+extern int AddPageTablePage();
+extern void PushPageTableSlot(PageTableSlot *slot);
+extern void UnlinkPageTableSlot(PageTableSlot *slot);
 
 
 #endif // function_H
\ No newline at end of file
@@ -50,12 +50,18 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
 
     TracePrintf(0, "LoadProgram '%s', args %p\n", name, args);
 
-    if ((fd = open(name, O_RDONLY)) < 0) {
+    // A recently run program comes from the image cache, with no file I/O at all.
+    ImageCacheEntry *cached = LookupImageCache(name);
+    if (cached != NULL) {
+	fd = -1;
+	li = cached->li;
+	status = LI_SUCCESS;
+    } else if ((fd = open(name, O_RDONLY)) < 0) {
 	TracePrintf(0, "LoadProgram: can't open file '%s'\n", name);
 	return (-1);
+    } else {
+	status = LoadInfo(fd, &li);
     }
-
-    status = LoadInfo(fd, &li);
     TracePrintf(0, "LoadProgram: LoadInfo status %d\n", status);
     switch (status) {
 	case LI_SUCCESS:
@@ -138,7 +144,7 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
 	    "LoadProgram: program '%s' size too large for VIRTUAL memory\n",
 	    name);
 	free(argbuf);
-	close(fd);
+	if (fd >= 0) close(fd);
 	return (-1);
     }
 
@@ -154,19 +160,43 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     // >>>> freed below before we allocate the needed pages for
     // >>>> the new program being loaded.
 
+    // Only frames this process does not share with another (since Fork) are actually freed below. They are
+    // only counted if the free frames are not enough already, and then only among the pages in use.
     int alr_alloc_pages = 0;
-    for (i = 0; i < PAGE_TABLE_LEN - KERNEL_STACK_PAGES; i++) {
-        if (curr_proc->pgt_r0[i].valid == 1) {
-            alr_alloc_pages++;
+    if (stack_npg > free_pframe_count && curr_proc->resident_pages > 0) {
+        for (i = NextUsedPage(curr_proc, 0); i < USER_PAGES; i = NextUsedPage(curr_proc, i + 1)) {
+            if ((curr_proc->pgt_r0[i].valid == 1 || (curr_proc->pgt_r0[i].unused & PTE_UNREF))
+                && frame_refcount[curr_proc->pgt_r0[i].pfn] == 1) {
+                alr_alloc_pages++;
+            }
         }
     }
 
-    if (text_npg + data_bss_npg + stack_npg > free_pframe_count + alr_alloc_pages) {
+    // Text, data and bss pages get frames only when first touched (see FaultInPage), so just the stack is needed now;
+    // cold pages of other processes are swapped out to make room if need be.
+    if (stack_npg > free_pframe_count + alr_alloc_pages && EnsureFreeFrames(stack_npg - alr_alloc_pages) == ERROR) {
 	TracePrintf(0,
 	    "LoadProgram: program '%s' size too large for PHYSICAL memory\n",
 	    name);
 	free(argbuf);
+	if (fd >= 0) close(fd);
+	return (-1);
+    }
+
+    // On a miss, keep the text and data in the image cache for the next Exec of this file.
+    if (cached == NULL && (cached = AddImageCache(name, fd, &li)) != NULL) {
 	close(fd);
+	fd = -1;
+    }
+
+    // The image keeps the cache entry (or else the file open), so the text and data can be brought
+    // in a page at a time later. If another process is running the same file, its image (and its
+    // text frames) are shared.
+    ProgramImage *image = GetProgramImage(fd, cached, &li);
+    if (image == NULL) {
+	TracePrintf(0, "LoadProgram: no memory for image of program '%s'\n", name);
+	free(argbuf);
+	if (fd >= 0) close(fd);
 	return (-1);
     }
 
@@ -187,23 +217,28 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     // >>>> memory page indicated by that PTE's pfn field.  Set all
     // >>>> of these PTEs to be no longer valid.
 
-    for (i = 0; i < PAGE_TABLE_LEN - KERNEL_STACK_PAGES; i++) {
-         if (curr_proc->pgt_r0[i].valid == 1) {
-            // Free page with associated pfn.
-            FreePhysicalPage(curr_proc->pgt_r0[i].pfn);
-
-            // Set virtual page as no longer valid.
-            curr_proc->pgt_r0[i].valid = 0;
+    // Only pages marked in use hold anything; every other user pte is invalid and untagged already.
+    for (i = NextUsedPage(curr_proc, 0); i < USER_PAGES; i = NextUsedPage(curr_proc, i + 1)) {
+        if (curr_proc->pgt_r0[i].valid == 1) {
+            TLBInvalidate((unsigned long) i << PAGESHIFT);
         }
+
+        // Free the page's frame (or swap slot), and set it as no longer valid.
+        ReleaseUserPage(curr_proc, i);
     }
 
+    // The old program's pages are gone, so switch to the new image.
+    ReleaseProgramImage(curr_proc->image);
+    curr_proc->image = image;
+
 
     /*
      *  Fill in the page table with the right number of text,
-     *  data+bss, and stack pages.  We set all the text pages
-     *  here to be read/write, just like the data+bss and
-     *  stack pages, so that we can read the text into them
-     *  from the file.  We then change them read/execute.
+     *  data+bss, and stack pages.  Text and data pages start
+     *  invalid and are read from the program image on their
+     *  first fault, straight into the frame, so they get their
+     *  final protections here.  Bss pages start invalid and
+     *  are zero-filled on their first fault.
      */
 
     // >>>> Leave the first MEM_INVALID_PAGES number of PTEs in the
@@ -214,52 +249,31 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     }
 
     /* First, the text pages */
-    // >>>> For the next text_npg number of PTEs in the Region 0
-    // >>>> page table, initialize each PTE:
-    // >>>>     valid = 1
-    // >>>>     kprot = PROT_READ | PROT_WRITE
-    // >>>>     uprot = PROT_READ | PROT_EXEC
-    // >>>>     pfn   = a new page of physical memory
-
+    // Each text pte is invalid, tagged PTE_FILE, with its page number in the image
+    // in pfn, and read/execute for the user, read/execute for the kernel.
 
     for (i = MEM_INVALID_PAGES; i < MEM_INVALID_PAGES + text_npg; i++) {
-        curr_proc->pgt_r0[i].valid = 1;
-        curr_proc->pgt_r0[i].kprot = PROT_READ | PROT_WRITE;
+        curr_proc->pgt_r0[i].valid = 0;
+        curr_proc->pgt_r0[i].unused = PTE_FILE;
+        curr_proc->pgt_r0[i].pfn = i - MEM_INVALID_PAGES;
+        curr_proc->pgt_r0[i].kprot = PROT_READ | PROT_EXEC;
         curr_proc->pgt_r0[i].uprot = PROT_READ | PROT_EXEC;
-
-        long frame_num;
-        if ((frame_num = AllocateFreePage()) < 0) {
-            TracePrintf(0, "LoadProgram: no more physical pages left for program '%s'\n", name);
-	        free(argbuf);
-	        close(fd);
-	        return (-1);
-        } else {
-            curr_proc->pgt_r0[i].pfn = (unsigned int) frame_num;
-        }
+        MarkPageUsed(curr_proc, i);
     }
 
     /* Then the data and bss pages */
-    // >>>> For the next data_bss_npg number of PTEs in the Region 0
-    // >>>> page table, initialize each PTE:
-    // >>>>     valid = 1
-    // >>>>     kprot = PROT_READ | PROT_WRITE
-    // >>>>     uprot = PROT_READ | PROT_WRITE
-    // >>>>     pfn   = a new page of physical memory
-
+    // Pages holding any data from the file are tagged like the text pages, but
+    // read/write; pages of only bss are left untagged, so they are zero-filled.
 
     for (i = MEM_INVALID_PAGES + text_npg; i < MEM_INVALID_PAGES + text_npg + data_bss_npg; i++) {
-        curr_proc->pgt_r0[i].valid = 1;
+        curr_proc->pgt_r0[i].valid = 0;
         curr_proc->pgt_r0[i].kprot = PROT_READ | PROT_WRITE;
         curr_proc->pgt_r0[i].uprot = PROT_READ | PROT_WRITE;
 
-        long frame_num;
-        if ((frame_num = AllocateFreePage()) < 0) {
-            TracePrintf(0, "LoadProgram: no more physical pages left for program '%s'\n", name);
-	        free(argbuf);
-	        close(fd);
-	        return (-1);
-        } else {
-            curr_proc->pgt_r0[i].pfn = (unsigned int) frame_num;
+        if ((unsigned long) (i - MEM_INVALID_PAGES) << PAGESHIFT < image->file_size) {
+            curr_proc->pgt_r0[i].unused = PTE_FILE;
+            curr_proc->pgt_r0[i].pfn = i - MEM_INVALID_PAGES;
+            MarkPageUsed(curr_proc, i);
         }
     }
 
@@ -278,7 +292,6 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
 
     int ustack_pg_limit = USER_STACK_LIMIT >> PAGESHIFT;
     for (i = ustack_pg_limit - stack_npg; i < ustack_pg_limit ; i++) {
-        curr_proc->pgt_r0[i].valid = 1;
         curr_proc->pgt_r0[i].kprot = PROT_READ | PROT_WRITE;
         curr_proc->pgt_r0[i].uprot = PROT_READ | PROT_WRITE;
 
@@ -286,10 +299,16 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
         if ((frame_num = AllocateFreePage()) < 0) {
             TracePrintf(0, "LoadProgram: no more physical pages left for program '%s'\n", name);
 	        free(argbuf);
-	        close(fd);
-	        return (-1);
+	        TLBFlushPending();
+	        // The old pages are gone and the new image is in place, so the process cannot go on; exit frees the
+	        // stack pages filled so far.
+	        return (-2);
         } else {
+            // Only a pte that holds its frame is valid, so exit frees exactly the pages filled so far.
             curr_proc->pgt_r0[i].pfn = (unsigned int) frame_num;
+            curr_proc->pgt_r0[i].valid = 1;
+            curr_proc->resident_pages++;
+            MarkPageUsed(curr_proc, i);
             TracePrintf(0, "LoadProgram: user stack idx filled was '%d'\n", i);
         }
     }
@@ -297,47 +316,12 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     curr_proc->uStack_bottom = ustack_pg_limit - stack_npg;
 
     /*
-     *  All pages for the new address space are now in place.  Flush
-     *  the TLB to get rid of all the old PTEs from this process, so
-     *  we'll be able to do the read() into the new pages below.
+     *  The page table for the new address space is now in place.
+     *  Flush the TLB to get rid of all the old PTEs from this process
+     *  (just the pages that were valid, or all of region 0 if there
+     *  were many). The text, data and bss are brought in by FaultInPage.
      */
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
-
-    /*
-     *  Read the text and data from the file into memory.
-     */
-    
-    if (read(fd, (void *)MEM_INVALID_SIZE, li.text_size+li.data_size) != (long) (li.text_size+li.data_size)) {
-	TracePrintf(0, "LoadProgram: couldn't read for '%s'\n", name);
-	free(argbuf);
-	close(fd);
-	// >>>> Since we are returning -2 here, this should mean to
-	// >>>> the rest of the kernel that the current process should
-	// >>>> be terminated with an exit status of ERROR reported
-	// >>>> to its parent process.
-	return (-2);
-    }
-
-    close(fd);			/* we've read it all now */
-
-    /*
-     *  Now set the page table entries for the program text to be readable
-     *  and executable, but not writable.
-     */
-    // >>>> For text_npg number of PTEs corresponding to the user text
-    // >>>> pages, set each PTE's kprot to PROT_READ | PROT_EXEC.
-
-    for (i = MEM_INVALID_PAGES; i < MEM_INVALID_PAGES + text_npg; i++) {
-        curr_proc->pgt_r0[i].kprot = PROT_READ | PROT_EXEC;
-    }
-
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
-
-    /*
-     *  Zero out the bss
-     */
-    memset((void *)(MEM_INVALID_SIZE + li.text_size + li.data_size),
-	'\0', li.bss_size);
+    TLBFlushPending();
 
     /*
      *  Set the entry point in the ExceptionInfo.
@@ -387,59 +371,184 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
 /*******   HELPER FUNCTIONS FOR PHYSICAL PAGES AND PCB DATA STRUCTURES. *******/
 
 /* 
- * Helper function to deallocate physical page with specified
- * pfn, and set it as a free page. Inserts it to front of the 
- * linked list of free pages, and increments count.
+ * Helper function to map physical frame pfn into one of the kernel mapping
+ * slots at KMAP_BASE so the kernel can read or write it. Reuses a slot that
+ * already maps pfn; otherwise remaps the least recently used slot nobody is
+ * using, flushing only that slot's TLB entry. Returns the slot's address,
+ * which stays valid until the matching KUnmap.
+ */
+void *
+KMap(unsigned long pfn)
+{
+    int slot;
+    int victim = -1;
+
+    kmap_clock++;
+
+    for (slot = 0; slot < KMAP_SLOTS; slot++) {
+        if (kmap_pfn[slot] == (long) pfn) {
+            kmap_pins[slot]++;
+            kmap_last_use[slot] = kmap_clock;
+            kmap_hits++;
+            return (void *) (KMAP_BASE + ((unsigned long) slot << PAGESHIFT));
+        }
+        if (kmap_pins[slot] == 0 && (victim == -1 || kmap_last_use[slot] < kmap_last_use[victim])) {
+            victim = slot;
+        }
+    }
+
+    // Every slot in use at once is a kernel bug: no caller holds more than two.
+    if (victim == -1) {
+        printf("KMap: every kernel mapping slot is in use.\n");
+        Halt();
+    }
+
+    unsigned long addr = KMAP_BASE + ((unsigned long) victim << PAGESHIFT);
+    unsigned long r1_idx = (addr - VMEM_1_BASE) >> PAGESHIFT;
+
+    pgt_r1[r1_idx].valid = 1;
+    pgt_r1[r1_idx].pfn = (unsigned int) pfn;
+    pgt_r1[r1_idx].uprot = PROT_NONE;
+    pgt_r1[r1_idx].kprot = (PROT_READ | PROT_WRITE);
+
+    TLBFlushAddress(addr);
+
+    kmap_pfn[victim] = (long) pfn;
+    kmap_pins[victim] = 1;
+    kmap_last_use[victim] = kmap_clock;
+    kmap_misses++;
+
+    return (void *) addr;
+}
+
+/* 
+ * Helper function to release a slot returned by KMap. The frame stays
+ * mapped there, so mapping it again soon is a hit.
+ */
+void
+KUnmap(void *addr)
+{
+    int slot = ((unsigned long) addr - KMAP_BASE) >> PAGESHIFT;
+    kmap_pins[slot]--;
+}
+
+/* 
+ * Helper function to copy the contents of frame src_pfn into frame
+ * dst_pfn, with both mapped at once.
+ */
+void
+CopyFrame(unsigned long dst_pfn, unsigned long src_pfn)
+{
+    void *src = KMap(src_pfn);
+    void *dst = KMap(dst_pfn);
+
+    memcpy(dst, src, PAGESIZE);
+
+    KUnmap(dst);
+    KUnmap(src);
+}
+
+/* 
+ * Helper function to fill frame pfn with zeros.
+ */
+void
+ZeroFrame(unsigned long pfn)
+{
+    void *frame = KMap(pfn);
+    memset(frame, 0, PAGESIZE);
+    KUnmap(frame);
+}
+
+/* 
+ * Helper function to drop one reference to physical page with
+ * specified pfn. Once nobody maps it any more, set it as a free
+ * page: push it on the front of the free list by storing the old
+ * head in the frame itself, and increment count.
  */
 void
 FreePhysicalPage(unsigned int pfn)
 {   
-    TracePrintf(0, "FreePhysicalPage: freeing pfn (%d)\n", pfn);
+    // The zero frame is mapped everywhere without being counted, and never freed.
+    if ((long) pfn == zero_pfn) {
+        return;
+    }
 
-    // Create new frame.
-    pframe *temp = (pframe *) malloc(sizeof(pframe));
-    
-    // If we cannot free a physical page, we need to Halt process as it does not have enough memory to even free pages.
-    if (temp == NULL) {
-        printf("No memory left to free physical page. Now Halting kernel.\n");
-        Halt();
+    // Frames shared copy-on-write are only freed by their last user.
+    if (--frame_refcount[pfn] > 0) {
+        TracePrintf(0, "FreePhysicalPage: pfn (%d) still shared (%d)\n", pfn, frame_refcount[pfn]);
+        return;
     }
 
-    temp->frame_num = pfn;
+    TracePrintf(0, "FreePhysicalPage: freeing pfn (%d)\n", pfn);
 
-    // Insert into linked list of free frames.
-    temp->next = free_pframe_head;
-    free_pframe_head = temp;
+    // Link the frame in front of the current head of the free list.
+    long *link = (long *) KMap(pfn);
+    *link = free_pframe_head;
+    KUnmap(link);
+    free_pframe_head = (long) pfn;
 
     // Increment free page counter.
     free_pframe_count++;
 }
 
 
+/*
+ * Takes a frame off the free list, or else the next frame that has never
+ * been handed out. Neither touches the zeroed pool or reclaims anything, and
+ * the frame stays counted as free; AllocateFreePage does the counting.
+ * Returns the frame number, or -1 if both are empty.
+ */
+long
+TakeFreeFrame()
+{
+    long free_frame_num;
+
+    if (free_pframe_head != NO_FRAME) {
+        // Take the head; its first word links to the next free frame.
+        free_frame_num = free_pframe_head;
+        long *link = (long *) KMap((unsigned long) free_frame_num);
+        free_pframe_head = *link;
+        KUnmap(link);
+    } else if (next_untouched_pfn < num_pframes) {
+        // Take the next never-used frame, stepping over the kernel's reserved frames.
+        free_frame_num = (long) next_untouched_pfn++;
+        if (next_untouched_pfn == kernel_reserved_lo) {
+            next_untouched_pfn = kernel_reserved_hi;
+        }
+    } else {
+        return (-1);
+    }
+
+    return free_frame_num;
+}
+
 /* 
- * Helper function to allocate free physical page. Updates
- * free frame linked list and counter. Frees memory of now used
- * frame. Returns the frame number of the allocated frame.
+ * Helper function to allocate free physical page. Takes the head
+ * of the free list if there is one, otherwise the next frame that
+ * has never been handed out, then a frame from the zeroed pool, and
+ * only then one freed by swapping out cold user pages. Updates counter. Returns the frame number of the allocated
+ * frame, or -1 if there is none left.
  */
 long
 AllocateFreePage()
 {
-    // Check if any free pages left.
-    if (free_pframe_head == NULL) {
+    long free_frame_num = TakeFreeFrame();
+
+    if (free_frame_num >= 0) {
+        // Taken from the free list or the never-used frames; nothing more to do.
+    } else if (zero_pool_count > 0) {
+        // Zeroed frames are still free memory, so use them rather than fail.
+        free_frame_num = zero_pool[--zero_pool_count];
+    } else if (ReclaimFrames() > 0) {
+        // Cold user pages were written to the swap file, so their frames are on the free list now.
+        return AllocateFreePage();
+    } else {
         return (-1); // Error code.
     }
 
-    // If there is, take the head as new frame.
-    pframe *temp = free_pframe_head;
-    pframe *next = free_pframe_head->next;
-    unsigned int free_frame_num = free_pframe_head->frame_num;
-
-    // Free frame.
-    free(temp);
-
-    // Decrement counter, and change head.
+    // Decrement counter. The caller holds the only reference.
     free_pframe_count--;
-    free_pframe_head = next;
+    frame_refcount[free_frame_num] = 1;
     
     TracePrintf(0, "AllocateFreePage: allocating pfn (%d)\n", free_frame_num);
 
@@ -447,6 +556,90 @@ AllocateFreePage()
 }
 
 
+/* 
+ * Helper function to add a reference to an allocated physical
+ * page that another page table entry now maps as well.
+ */
+void
+ShareFrame(unsigned int pfn)
+{
+    if ((long) pfn != zero_pfn) {
+        frame_refcount[pfn]++;
+    }
+}
+
+/* 
+ * Returns the live process with the given pid, or NULL if there is none.
+ * The slot is found directly from the pid; comparing the full pid rejects
+ * stale pids whose slot has since been reused.
+ */
+PCB*
+FindProcess(int pid)
+{
+    if (pid < 0) {
+        return NULL;
+    }
+
+    PCB *pcb = proc_table[pid & (PROC_TABLE_SIZE - 1)];
+    if (pcb == NULL || pcb->pid != pid) {
+        return NULL;
+    }
+    return pcb;
+}
+
+/* 
+ * Helper function to add a new process to the process table. Takes the
+ * least recently freed slot and assigns the pid from the slot index and
+ * its generation. Returns 0 on success, ERROR if the table is full.
+ */
+int
+InsertProcess(PCB *pcb)
+{
+    if (proc_free_count == 0) {
+        TracePrintf(0, "InsertProcess: process table is full.\n");
+        return ERROR;
+    }
+
+    int slot = proc_free_slots[proc_free_head];
+    proc_free_head = (proc_free_head + 1) % PROC_TABLE_SIZE;
+    proc_free_count--;
+
+    pcb->pid = (int) (proc_generation[slot] * PROC_TABLE_SIZE + slot);
+    proc_table[slot] = pcb;
+    proc_table_count++;
+
+    TracePrintf(0, "InsertProcess: process (%d) in slot (%d).\n", pcb->pid, slot);
+
+    return 0;
+}
+
+/* 
+ * Helper function to remove a process from the process table. Bumps the
+ * slot's generation so its next pid differs, and queues the slot at the
+ * back of the free ring.
+ */
+void
+RemoveProcess(PCB *pcb)
+{
+    int slot = pcb->pid & (PROC_TABLE_SIZE - 1);
+    if (proc_table[slot] != pcb) {
+        TracePrintf(0, "RemoveProcess: process (%d) is not in the process table.\n", pcb->pid);
+        return;
+    }
+
+    proc_table[slot] = NULL;
+    proc_table_count--;
+
+    // Keep pids positive; restart at generation 1 so pids 0 (idle) and 1 (init) are never handed out again.
+    proc_generation[slot]++;
+    if (proc_generation[slot] > (unsigned int) (0x7fffffff / PROC_TABLE_SIZE) - 1) {
+        proc_generation[slot] = 1;
+    }
+
+    proc_free_slots[(proc_free_head + proc_free_count) % PROC_TABLE_SIZE] = slot;
+    proc_free_count++;
+}
+
 /* 
  * Helper function to create PCB including all
  * allocation of memory and setting of fields. Returns
@@ -459,26 +652,37 @@ CreatePCB(PCB* parent)
 
     // Build PCB structure.
     PCB *new_pcb = malloc(sizeof(PCB)); 
+    if (new_pcb == NULL) {
+        return NULL;
+    }
 
     // Fields.
     if (parent == NULL) {
         new_pcb->parent_pid = 0;
-        new_pcb->parent = NULL;
     } else {
         new_pcb->parent_pid = parent->pid;
-        new_pcb->parent = parent;
     }
-    new_pcb->pid = pid_counter++;
+
     new_pcb->runningTime = 0;
+    new_pcb->priority = 0;
     new_pcb->needs_copy = -1;
-    new_pcb->isDelayed = -1;
-    new_pcb->isTerminated = -1;
+    new_pcb->state = PROC_READY;
+    new_pcb->blocked_since = 0;
+    new_pcb->q_next = NULL;
+    new_pcb->q_prev = NULL;
+    new_pcb->q_owner = NULL;
     new_pcb->exited_children = CreateLinkedList();
-    new_pcb->running_children = CreateLinkedList();
+    new_pcb->running_children.head = NULL;
+    new_pcb->running_children.tail = NULL;
+    new_pcb->sibling_next = NULL;
+    new_pcb->sibling_prev = NULL;
+    new_pcb->image = NULL;
 
     // Allocate memory for page table, region 0.
     if (AllocateRegion0PageTable(new_pcb) == -1) {
         // If we run into error allocating page table, return NULL pcb.
+        free(new_pcb->exited_children);
+        free(new_pcb);
         return NULL;
     }
 
@@ -486,17 +690,23 @@ CreatePCB(PCB* parent)
     new_pcb->uStack_bottom = USER_STACK_LIMIT;
     new_pcb->brk = MEM_INVALID_SIZE;
 
-    // Set invalid pte entries in page table as invalid (as allocated pfn may have been previously used).
-    int i = 0;
-    for (; i < MEM_INVALID_PAGES; i++) {
-        new_pcb->pgt_r0[i].valid = 0;
-    }
+    // The page table's frame may have been used before, so start with every user pte invalid and untagged.
+    memset(new_pcb->pgt_r0, 0, USER_PAGES * sizeof(struct pte));
+    memset(new_pcb->page_map, 0, sizeof(new_pcb->page_map));
+    new_pcb->resident_pages = 0;
     
     // Allocate memory for saved context.
     new_pcb->ctx = (SavedContext *) malloc(sizeof(SavedContext));
 
-    // Check if any fields in PCB are NULL; if so, we need to return NULL to signal to we could not create a PCB struct.
-    if (new_pcb == NULL || new_pcb->exited_children == NULL || new_pcb->running_children == NULL || new_pcb->ctx == NULL) {
+    // Take a process table slot, which also assigns the pid. This comes last: the allocations above may reclaim
+    // frames, and the swap clock and the other scanners walk the page table and page map of every process in the
+    // table. If anything failed, give back everything taken above and return NULL to signal we could not create a
+    // PCB struct.
+    if (new_pcb->exited_children == NULL || new_pcb->ctx == NULL || InsertProcess(new_pcb) == ERROR) {
+        FreeRegion0PageTable(new_pcb);
+        free(new_pcb->exited_children);
+        free(new_pcb->ctx);
+        free(new_pcb);
         return NULL;
     }
 
@@ -505,6 +715,29 @@ CreatePCB(PCB* parent)
     return new_pcb;
 }
 
+/*
+ * Frees a process made by CreatePCB that has never run, e.g. when Fork or
+ * Spawn cannot copy its kernel stack: whatever user pages it shares or holds,
+ * its program image, its process table slot, page table and the PCB itself.
+ * Its page table was never loaded into the hardware, so there is nothing to
+ * flush. The caller takes it off its parent's children first.
+ */
+void
+DestroyUnstartedPCB(PCB *pcb)
+{
+    unsigned long i;
+    for (i = NextUsedPage(pcb, 0); i < USER_PAGES; i = NextUsedPage(pcb, i + 1)) {
+        ReleaseUserPage(pcb, i);
+    }
+    ReleaseProgramImage(pcb->image);
+
+    RemoveProcess(pcb);
+    FreeRegion0PageTable(pcb);
+    free(pcb->exited_children);
+    free(pcb->ctx);
+    free(pcb);
+}
+
 /* 
  * Helper function to create PCB struct for idle process. Must be
  * passed an already-allocated page table region 0.
@@ -520,28 +753,40 @@ CreateIdlePCB()
 
     // Fields.
     new_pcb->parent_pid = -1;
-    new_pcb->parent = NULL;
-    new_pcb->pid = pid_counter++;
     new_pcb->runningTime = 0;
+    new_pcb->priority = 0;
     new_pcb->needs_copy = -1;
-    new_pcb->isDelayed = -1;
-    new_pcb->isTerminated = -1;
+    new_pcb->state = PROC_RUNNING;
+    new_pcb->blocked_since = 0;
+    new_pcb->q_next = NULL;
+    new_pcb->q_prev = NULL;
+    new_pcb->q_owner = NULL;
     new_pcb->exited_children = CreateLinkedList();
-    new_pcb->running_children = CreateLinkedList();
+    new_pcb->running_children.head = NULL;
+    new_pcb->running_children.tail = NULL;
+    new_pcb->sibling_next = NULL;
+    new_pcb->sibling_prev = NULL;
+    new_pcb->image = NULL;
 
-    // Set pointer to region 0 page table for init process.
+    // Set pointer to region 0 page table for init process. Its user ptes start invalid and untagged.
     new_pcb->pgt_r0 = pgt_r0;
+    memset(new_pcb->pgt_r0, 0, USER_PAGES * sizeof(struct pte));
+    memset(new_pcb->page_map, 0, sizeof(new_pcb->page_map));
+    new_pcb->resident_pages = 0;
     new_pcb->brk = MEM_INVALID_SIZE;
 
     // No user stack yet.
     new_pcb->uStack_bottom = USER_STACK_LIMIT;
     new_pcb->pgt_r0_paddr = (unsigned long) new_pcb->pgt_r0;
+
+    // Only now that its page table and page map are set up can the memory scanners see it. First slot, so idle's pid is 0.
+    InsertProcess(new_pcb);
     
     // Allocate memory for saved context.
     new_pcb->ctx = (SavedContext *) malloc(sizeof(SavedContext));
     
     // Check if any fields in PCB are NULL; if so, we need to return NULL to signal to we could not create a PCB struct.
-    if (new_pcb == NULL || new_pcb->exited_children == NULL || new_pcb->running_children == NULL || new_pcb->ctx == NULL) {
+    if (new_pcb == NULL || new_pcb->exited_children == NULL || new_pcb->ctx == NULL) {
         return NULL;
     }
 
@@ -552,73 +797,149 @@ CreateIdlePCB()
 
 /* 
  * Helper function to allocate a region 0 page table for a new process.
- * Saves space by allocating two page tables per page in memory.
+ * Saves space by allocating two page tables per page in memory. Takes a
+ * free half-page slot from the pool, mapping a new page for it if there
+ * is none. Returns 1 on success, -1 if no page could be mapped.
  */
 int
 AllocateRegion0PageTable(PCB* pcb)
 {   
     TracePrintf(0, "AllocateRegion0PageTable: trying to allocate page table.\n");
 
-    // If the page for the page table region 0 is already half used.
-    if (is_half_used == 1) {
-        TracePrintf(0, "AllocateRegion0PageTable: already has half used page.\n");
-        // Set the pcb's pgt_r0 to second half of already used page
-        pcb->pgt_r0 = (struct pte*) (addr_next_pgt_r0 + PAGESIZE/2);
+    // If every page table page is full, map a new one.
+    if (pgt_free_head == NULL && AddPageTablePage() == -1) {
+        return (-1); // Error
+    }
+
+    PageTableSlot *slot = pgt_free_head;
+    UnlinkPageTableSlot(slot);
 
-        // Set the pcb's paddr for its page table
-        pcb->pgt_r0_paddr = curr_pgt_paddr + PAGESIZE/2;
+    // Mark this half of the page as used.
+    unsigned long r1_idx = (DOWN_TO_PAGE((unsigned long) slot) - VMEM_1_BASE) >> PAGESHIFT;
+    unsigned long offset = (unsigned long) slot & PAGEOFFSET;
+    pgt_r1[r1_idx].unused |= (offset == 0) ? PGT_HALF_LO : PGT_HALF_HI;
 
-        TracePrintf(0, "AllocateRegion0PageTable: physical addr is (0x%lx).\n", pcb->pgt_r0_paddr);
+    pcb->pgt_r0 = (struct pte*) slot;
+    pcb->pgt_r0_paddr = ((unsigned long) pgt_r1[r1_idx].pfn << PAGESHIFT) | offset;
 
-        // Reset half-used flag.
-        is_half_used = 0;
+    TracePrintf(0, "AllocateRegion0PageTable: page table at (0x%lx), physical addr is (0x%lx).\n", (unsigned long) slot, pcb->pgt_r0_paddr);
 
-        // Decrement addr for next page talbe region 0 memory location
-        addr_next_pgt_r0 -= PAGESIZE;
+    return (1); // Success
+}
 
-        return (1); // Success
+/*
+ * Gives a process's region 0 page table back to the pool. Must only be
+ * called once the hardware no longer uses it (ie. after REG_PTR0 has been
+ * switched away). If the other half of its page is free too, the whole
+ * frame is given back to the frame allocator and the page becomes a hole
+ * that AddPageTablePage maps again before growing the area further.
+ */
+void
+FreeRegion0PageTable(PCB* pcb)
+{
+    PageTableSlot *slot = (PageTableSlot *) pcb->pgt_r0;
+    unsigned long page = DOWN_TO_PAGE((unsigned long) slot);
+    unsigned long r1_idx = (page - VMEM_1_BASE) >> PAGESHIFT;
+
+    pgt_r1[r1_idx].unused &= ((unsigned long) slot & PAGEOFFSET) ? ~PGT_HALF_HI : ~PGT_HALF_LO;
+
+    // The other half still holds a page table, so just make this half available.
+    if (pgt_r1[r1_idx].unused & (PGT_HALF_LO | PGT_HALF_HI)) {
+        PushPageTableSlot(slot);
+        return;
     }
-    // If we need to allocate a new page.
-    else {
-        TracePrintf(0, "AllocateRegion0PageTable: allocating new page.\n");
-        // Set the pcb's pgt_r0 to first half of new page
-        pcb->pgt_r0 = (struct pte*) (addr_next_pgt_r0);
 
-        TracePrintf(0, "AllocateRegion0PageTable: address of new pt r0 is %lx.\n", pcb->pgt_r0);
+    TracePrintf(0, "FreeRegion0PageTable: page table page (0x%lx) is empty, freeing pfn (%d).\n", page, pgt_r1[r1_idx].pfn);
 
-        // Now, we need to get a free frame and update region 1's page table as needed
-        unsigned long r1_idx = ((unsigned long) addr_next_pgt_r0 - VMEM_1_BASE) >> PAGESHIFT;
+    // Both halves are free: the other one is on the free list, so take it off.
+    UnlinkPageTableSlot((PageTableSlot *) ((unsigned long) slot ^ (PAGESIZE / 2)));
 
-        // If we run into already allocated memory, we need to exit process.
-        if (pgt_r1[r1_idx].valid == 1) {
-            return (-1); // Error
-        }
+    FreePhysicalPage(pgt_r1[r1_idx].pfn);
+
+    // Leave a hole, chained through the invalid pte's pfn field.
+    pgt_r1[r1_idx].valid = 0;
+    pgt_r1[r1_idx].pfn = (unsigned int) pgt_hole_head;
+    pgt_hole_head = r1_idx;
 
-        // Otherwise, get a new page and set it.
-        long new_page_pfn = AllocateFreePage();
-        curr_pgt_paddr = new_page_pfn << PAGESHIFT;
-        pcb->pgt_r0_paddr = curr_pgt_paddr;
+    TLBFlushAddress(page);
+}
 
+/*
+ * Maps one more page for region 0 page tables and puts both of its halves on
+ * the free list. Reuses a hole left by FreeRegion0PageTable if there is one,
+ * otherwise grows the page table area down towards the kernel heap. Returns 0
+ * on success, -1 if there is no free frame or the area would hit the heap.
+ */
+int
+AddPageTablePage()
+{
+    unsigned long r1_idx;
+    int from_hole = (pgt_hole_head != 0);
 
-        TracePrintf(0, "AllocateRegion0PageTable: physical addr is (0x%lx) and pfn (%d).\n", pcb->pgt_r0_paddr, new_page_pfn);
+    if (from_hole) {
+        r1_idx = pgt_hole_head;
+    } else {
+        r1_idx = (addr_next_pgt_r0 - VMEM_1_BASE) >> PAGESHIFT;
 
-        // Check if we have memory or not.
-        if (new_page_pfn == -1) {
+        // If we run into already allocated memory, we cannot grow any further.
+        if (pgt_r1[r1_idx].valid == 1 || addr_next_pgt_r0 < (unsigned long) UP_TO_PAGE(kernel_brk)) {
             return (-1); // Error
         }
+    }
+
+    long new_page_pfn = AllocateFreePage();
+
+    // Check if we have memory or not.
+    if (new_page_pfn == -1) {
+        return (-1); // Error
+    }
+
+    if (from_hole) {
+        pgt_hole_head = pgt_r1[r1_idx].pfn;
+    } else {
+        addr_next_pgt_r0 -= PAGESIZE;
+    }
 
-        pgt_r1[r1_idx].valid = 1;
-        pgt_r1[r1_idx].pfn = (unsigned int) new_page_pfn;
-        pgt_r1[r1_idx].uprot = PROT_NONE;
-        pgt_r1[r1_idx].kprot = (PROT_READ | PROT_WRITE);
+    pgt_r1[r1_idx].valid = 1;
+    pgt_r1[r1_idx].pfn = (unsigned int) new_page_pfn;
+    pgt_r1[r1_idx].uprot = PROT_NONE;
+    pgt_r1[r1_idx].kprot = (PROT_READ | PROT_WRITE);
+    pgt_r1[r1_idx].unused = 0;
 
-        WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_1);
+    unsigned long page = VMEM_1_BASE + (r1_idx << PAGESHIFT);
+    TLBFlushAddress(page);
 
-        // Reset half-used flag.
-        is_half_used = 1;
+    TracePrintf(0, "AddPageTablePage: mapped page table page (0x%lx) to pfn (%d).\n", page, new_page_pfn);
 
-        return (1); // Success
+    // Push the upper half first so the lower half is handed out first.
+    PushPageTableSlot((PageTableSlot *) (page + PAGESIZE / 2));
+    PushPageTableSlot((PageTableSlot *) page);
+
+    return 0;
+}
+
+/* Pushes a free half-page slot onto the front of the page table free list. */
+void
+PushPageTableSlot(PageTableSlot *slot)
+{
+    slot->prev = NULL;
+    slot->next = pgt_free_head;
+    if (pgt_free_head != NULL) {
+        pgt_free_head->prev = slot;
+    }
+    pgt_free_head = slot;
+}
+
+/* Takes a free half-page slot off the page table free list, wherever it is. */
+void
+UnlinkPageTableSlot(PageTableSlot *slot)
+{
+    if (slot->prev != NULL) {
+        slot->prev->next = slot->next;
+    } else {
+        pgt_free_head = slot->next;
+    }
+    if (slot->next != NULL) {
+        slot->next->prev = slot->prev;
     }
-    
-    (void) pcb;
 }
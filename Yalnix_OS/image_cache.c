@@ -0,0 +1,201 @@
+#include "function.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include </clear/courses/comp421/pub/include/comp421/yalnix.h>
+#include </clear/courses/comp421/pub/include/comp421/hardware.h>
+#include </clear/courses/comp421/pub/include/comp421/loadinfo.h>
+
+/*
+ * Returns the cache entry for the program file at path, moving it to the
+ * front of the LRU list, or NULL if the file is not cached. An entry only
+ * matches while the file still has the device, inode, size and modification
+ * time it had when it was cached, so a rebuilt program is read again.
+ */
+ImageCacheEntry *LookupImageCache(char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        image_cache_misses++;
+        return NULL;
+    }
+
+    ImageCacheEntry *entry;
+    for (entry = image_cache_head; entry != NULL; entry = entry->lru_next) {
+        if (strcmp(entry->path, path) == 0
+            && entry->dev == (unsigned long) st.st_dev && entry->ino == (unsigned long) st.st_ino
+            && entry->size == (unsigned long) st.st_size && entry->mtime == (long) st.st_mtime) {
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        image_cache_misses++;
+        TracePrintf(0, "LookupImageCache: miss for '%s'.\n", path);
+        return NULL;
+    }
+
+    // Move the entry to the front, as the most recently used.
+    UnlinkImageCacheEntry(entry);
+    PushImageCacheEntry(entry);
+
+    image_cache_hits++;
+    TracePrintf(0, "LookupImageCache: hit for '%s'.\n", path);
+
+    return entry;
+}
+
+/*
+ * Reads the text and data of the program open at fd (just after the header
+ * LoadInfo read into li) into a new cache entry for path, evicting least
+ * recently used entries no program image is using to make room. Returns the
+ * entry, or NULL if the program does not fit in the cache, there is no
+ * memory for it or the file cannot be read. The file offset of fd is left
+ * where it was.
+ */
+ImageCacheEntry *AddImageCache(char *path, int fd, struct loadinfo *li) {
+    unsigned long nbytes = li->text_size + li->data_size;
+    if (nbytes > IMAGE_CACHE_MAX_BYTES) {
+        return NULL;
+    }
+
+    // Evict idle entries from the tail until the new one fits.
+    ImageCacheEntry *victim = image_cache_tail;
+    while (image_cache_count == IMAGE_CACHE_MAX_ENTRIES || image_cache_bytes + nbytes > IMAGE_CACHE_MAX_BYTES) {
+        while (victim != NULL && victim->users > 0) {
+            victim = victim->lru_prev;
+        }
+        if (victim == NULL) {
+            TracePrintf(0, "AddImageCache: no room for '%s', every entry is in use.\n", path);
+            return NULL;
+        }
+
+        ImageCacheEntry *prev = victim->lru_prev;
+        EvictImageCacheEntry(victim);
+        victim = prev;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return NULL;
+    }
+
+    ImageCacheEntry *entry = (ImageCacheEntry *) malloc(sizeof(ImageCacheEntry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->path = (char *) malloc(strlen(path) + 1);
+    entry->bytes = (char *) malloc(nbytes > 0 ? nbytes : 1);
+    if (entry->path == NULL || entry->bytes == NULL) {
+        free(entry->path);
+        free(entry->bytes);
+        free(entry);
+        return NULL;
+    }
+
+    // Read the text and data in one go, then put the file offset back for the caller.
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (read(fd, entry->bytes, nbytes) != (long) nbytes) {
+        TracePrintf(0, "AddImageCache: couldn't read '%s'.\n", path);
+        lseek(fd, offset, SEEK_SET);
+        free(entry->path);
+        free(entry->bytes);
+        free(entry);
+        return NULL;
+    }
+    lseek(fd, offset, SEEK_SET);
+
+    strcpy(entry->path, path);
+    entry->dev = (unsigned long) st.st_dev;
+    entry->ino = (unsigned long) st.st_ino;
+    entry->size = (unsigned long) st.st_size;
+    entry->mtime = (long) st.st_mtime;
+    entry->li = *li;
+    entry->nbytes = nbytes;
+    entry->users = 0;
+
+    PushImageCacheEntry(entry);
+    image_cache_count++;
+    image_cache_bytes += nbytes;
+
+    TracePrintf(0, "AddImageCache: cached '%s' (%d bytes).\n", path, nbytes);
+
+    return entry;
+}
+
+/*
+ * Loads each program in names, a comma-separated list of program files, into
+ * the image cache, so the first Exec of each is already a hit. Programs that
+ * cannot be loaded are skipped.
+ */
+void PreloadImageCache(char *names) {
+    char *copy = (char *) malloc(strlen(names) + 1);
+    if (copy == NULL) {
+        return;
+    }
+    strcpy(copy, names);
+
+    char *name;
+    for (name = strtok(copy, ","); name != NULL; name = strtok(NULL, ",")) {
+        int fd;
+        struct loadinfo li;
+
+        if ((fd = open(name, O_RDONLY)) < 0) {
+            TracePrintf(0, "PreloadImageCache: can't open file '%s'\n", name);
+            continue;
+        }
+
+        if (LoadInfo(fd, &li) != LI_SUCCESS || AddImageCache(name, fd, &li) == NULL) {
+            TracePrintf(0, "PreloadImageCache: couldn't cache '%s'\n", name);
+        }
+
+        close(fd);
+    }
+
+    free(copy);
+}
+
+/*
+ * Removes an entry no program image is using from the cache and frees it.
+ */
+void EvictImageCacheEntry(ImageCacheEntry *entry) {
+    TracePrintf(0, "EvictImageCacheEntry: evicting '%s'.\n", entry->path);
+
+    UnlinkImageCacheEntry(entry);
+    image_cache_count--;
+    image_cache_bytes -= entry->nbytes;
+
+    free(entry->path);
+    free(entry->bytes);
+    free(entry);
+}
+
+/* Puts an entry at the front (most recently used end) of the LRU list. */
+void PushImageCacheEntry(ImageCacheEntry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = image_cache_head;
+    if (image_cache_head != NULL) {
+        image_cache_head->lru_prev = entry;
+    } else {
+        image_cache_tail = entry;
+    }
+    image_cache_head = entry;
+}
+
+/* Takes an entry off the LRU list. */
+void UnlinkImageCacheEntry(ImageCacheEntry *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        image_cache_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        image_cache_tail = entry->lru_prev;
+    }
+}
@@ -26,6 +26,12 @@ void TrapKernelHandler(ExceptionInfo *info){
             info->regs[0] = HandleExec((char *)info->regs[1], (char **)info->regs[2], info);
             break;
 
+        case YALNIX_SPAWN:
+            // Handle Spawn system call
+            info->regs[0] = HandleSpawn((char *)info->regs[1], (char **)info->regs[2], info);
+            TracePrintf(0, "Spawn call: Returned (%d)\n", (int) info->regs[0]);
+            break;
+
         case YALNIX_EXIT:
             // Handle Exit system call, no return value expected
             HandleExit((int)info->regs[1]);
@@ -88,6 +94,12 @@ int HandleFork(ExceptionInfo *info) {
     if (child_proc == NULL) {
         return ERROR;
     }
+
+    // MySwitchFunc copies the kernel stack into new frames for the child, so make sure there are enough first.
+    if (EnsureFreeFrames(KERNEL_STACK_PAGES) == ERROR) {
+        DestroyUnstartedPCB(child_proc);
+        return ERROR;
+    }
     
     // Copy over user stack and heap pointers to new child process.
     child_proc->uStack_bottom = curr_proc->uStack_bottom;
@@ -97,80 +109,82 @@ int HandleFork(ExceptionInfo *info) {
     int child_pid = child_proc->pid;
 
     // Update calling processes child fields.
-    enqueueToList(curr_proc->running_children, child_proc);
+    addRunningChild(curr_proc, child_proc);
 
 
 
-    /* Here begins the copying process (everything except kernel stack and ctx) */
+    /* Here begins the sharing process (everything except kernel stack and ctx) */
 
-    // Check if there is enough memory to copy current process.
-    int pages_needed = 0;
+    // Parent and child share every frame instead of copying it. Writable pages become read-only and
+    // copy-on-write in both; TrapMemoryHandler copies a page only when one of them writes to it.
     unsigned long i;
-    for (i = 0; i < PAGE_TABLE_LEN; i++) {
-        if (curr_proc->pgt_r0[i].valid == 1) {
-            pages_needed++;
-        }
-    }
-    if (pages_needed > free_pframe_count) {
-        return ERROR;
-    }
 
-    // First set up unused pte to copy into.
-    unsigned long pte_for_copy_pfn = USER_STACK_LIMIT >> PAGESHIFT;
+    // Loop through the pages curr_proc has in use (below the kernel stack); the child's other ptes start empty.
+    for (i = NextUsedPage(curr_proc, 0); i < USER_PAGES; i = NextUsedPage(curr_proc, i + 1)) {
+        // A page the swap clock is checking is in use after all, so it is shared like any resident page.
+        if (curr_proc->pgt_r0[i].unused & PTE_UNREF) {
+            curr_proc->pgt_r0[i].unused &= ~PTE_UNREF;
+            curr_proc->pgt_r0[i].valid = 1;
+        }
 
-    // Next, loop through everything region 0 except kernel stack for curr_proc.
-    for (i = MEM_INVALID_PAGES; i < PAGE_TABLE_LEN - KERNEL_STACK_PAGES; i++) {
-        // If this is the pte we use to copy-over, then set as invalid because this is not a valid pte idx.
-        if (i == pte_for_copy_pfn) {
-            child_proc->pgt_r0[i].valid = 0;
+        // Pages not brought in yet stay that way in the child, with the same tags. Both refer to the
+        // same swap slot or compressed copy of a page put aside, and each brings back its own copy.
+        if (curr_proc->pgt_r0[i].valid == 0) {
+            child_proc->pgt_r0[i] = curr_proc->pgt_r0[i];
+            if (curr_proc->pgt_r0[i].unused & PTE_SWAP) {
+                ShareSwapSlot(curr_proc->pgt_r0[i].pfn);
+            } else if (curr_proc->pgt_r0[i].unused & PTE_ZRAM) {
+                ShareZramEntry(curr_proc->pgt_r0[i].pfn);
+            }
             continue;
         }
 
-        // Set valid bit same for corresponding pte in curr and child process.
-        child_proc->pgt_r0[i].valid = curr_proc->pgt_r0[i].valid;
+        TracePrintf(0, "HandleFork: Sharing idx (%d)\n", i);
 
-        // If valid, we need to copy over.
-        if (curr_proc->pgt_r0[i].valid == 1 && i != pte_for_copy_pfn) {
-            TracePrintf(0, "HandleFork: Copying over idx (%d)\n", i);
-
-            curr_proc->pgt_r0[pte_for_copy_pfn].valid = 1;
-            curr_proc->pgt_r0[pte_for_copy_pfn].uprot = PROT_ALL;
-            curr_proc->pgt_r0[pte_for_copy_pfn].kprot = PROT_ALL;
-
-            // Allocate free page. Set transfer pte with same pfn.
-            child_proc->pgt_r0[i].pfn = AllocateFreePage();
-            curr_proc->pgt_r0[pte_for_copy_pfn].pfn = child_proc->pgt_r0[i].pfn;
+        // Write-protect the parent's page if it is writable, and remember that it is copy-on-write.
+        if (curr_proc->pgt_r0[i].uprot & PROT_WRITE) {
+            curr_proc->pgt_r0[i].uprot &= ~PROT_WRITE;
+            curr_proc->pgt_r0[i].kprot &= ~PROT_WRITE;
+            curr_proc->pgt_r0[i].unused |= PTE_COW;
+            TLBInvalidate(i << PAGESHIFT);
+        }
 
-            // TLB Flush region 0 page table as we mutate it.
-            WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+        // The child maps the same frame with the same (now read-only) protections.
+        child_proc->pgt_r0[i] = curr_proc->pgt_r0[i];
+        ShareFrame(curr_proc->pgt_r0[i].pfn);
+    }
 
-            // Copy memory from page in curr_proc to corresponding page in child_proc.
-            memcpy((void *) (pte_for_copy_pfn << PAGESHIFT), (void *) (i << PAGESHIFT), PAGESIZE);
+    // The child has the same pages in use, holding the same frames.
+    memcpy(child_proc->page_map, curr_proc->page_map, sizeof(curr_proc->page_map));
+    child_proc->resident_pages = curr_proc->resident_pages;
 
-            // Set all protections as needed.
-            child_proc->pgt_r0[i].uprot = curr_proc->pgt_r0[i].uprot;
-            child_proc->pgt_r0[i].kprot = curr_proc->pgt_r0[i].kprot;
-        }
-    }
-    curr_proc->pgt_r0[pte_for_copy_pfn].valid = 0;
+    // The child reads its unloaded text and data pages from the same program image.
+    child_proc->image = curr_proc->image;
+    ShareProgramImage(child_proc->image);
 
-    // TLB Flush region 0 page table as we mutate it.
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+    // TLB Flush the parent's write-protected pages (all of region 0 if there were many).
+    TLBFlushPending();
 
 
 
     /* Next, we perform context switch. */
 
-    // First, add child process into list of all processes.
-    enqueueToList(processQueue, child_proc);
-
     // Now, need to copy over kernel stack and saved context. First add curr_proc to ready queue.
-    enqueueToList(runningQueue, curr_proc);
+    MakeProcessReady(curr_proc);
 
     // Context switch to child_proc; copy over kernel stack and ctx in the process.
     curr_proc->needs_copy = 1;
     ContextSwitch(MySwitchFunc, curr_proc->ctx, curr_proc, child_proc);
 
+    // If the kernel stack could not be copied after all, we are still the parent; undo the child and fail.
+    if (curr_proc->needs_copy == 0) {
+        curr_proc->needs_copy = -1;
+        UnreadyProcess(curr_proc);
+        removeRunningChild(curr_proc, child_proc);
+        DestroyUnstartedPCB(child_proc);
+        return ERROR;
+    }
+
     // If in child process, return 0. Otherwise if in calling process, return child PID.
     if (curr_proc->pid == child_pid) {
         return 0;
@@ -184,8 +198,23 @@ int HandleFork(ExceptionInfo *info) {
 int HandleExec(char *filename, char **argvec, ExceptionInfo *info) {
     TracePrintf(0, "HandleExec: entered by process (%d)\n", curr_proc->pid);
 
+    // Copy the file name and arguments into region 1 first. LoadProgram reads them directly, and they may be in
+    // pages not brought in yet (text or data not loaded, or swapped out or compressed), which the kernel cannot
+    // fault in by touching them; besides, LoadProgram frees region 0 before it is done with them.
+    char *kfilename = CopyUserString(filename);
+    if (kfilename == NULL) {
+        return ERROR;
+    }
+    char **kargs = CopyUserArgs(argvec);
+    if (kargs == NULL) {
+        free(kfilename);
+        return ERROR;
+    }
+
     // Error checking is done in LoadProgram, so we call and process return value.
-    int status = LoadProgram(filename, argvec, info);
+    int status = LoadProgram(kfilename, kargs, info);
+    FreeKernelArgs(kargs);
+    free(kfilename);
 
     // If -1, return ERROR.
     if (status == -1) {
@@ -201,12 +230,88 @@ int HandleExec(char *filename, char **argvec, ExceptionInfo *info) {
     return 0; // Prevent compilation errors.
 }
 
+/* 
+ * Handles the Spawn system call: creates a child that runs filename with
+ * argvec, like Fork followed by Exec in the child, but without sharing or
+ * copying any of the caller's region 0. Only the kernel stack and saved
+ * context are copied. If the program cannot be loaded, the child exits
+ * with status ERROR.
+ */
+int HandleSpawn(char *filename, char **argvec, ExceptionInfo *info) {
+    TracePrintf(0, "HandleSpawn: entered by process (%d)\n", curr_proc->pid);
+
+    // Copy the file name and arguments into region 1, since the child cannot see the caller's region 0.
+    char *kfilename = CopyUserString(filename);
+    if (kfilename == NULL) {
+        return ERROR;
+    }
+    char **kargs = CopyUserArgs(argvec);
+    if (kargs == NULL) {
+        free(kfilename);
+        return ERROR;
+    }
+
+    // Initalize PCB struct for new process.
+    PCB* child_proc = CreatePCB(curr_proc);
+    
+    // If PCB was not allocated sucessfully, return ERROR.
+    if (child_proc == NULL) {
+        FreeKernelArgs(kargs);
+        free(kfilename);
+        return ERROR;
+    }
+
+    // MySwitchFunc copies the kernel stack into new frames for the child, so make sure there are enough first.
+    if (EnsureFreeFrames(KERNEL_STACK_PAGES) == ERROR) {
+        DestroyUnstartedPCB(child_proc);
+        FreeKernelArgs(kargs);
+        free(kfilename);
+        return ERROR;
+    }
+
+    // Hold child PID, and update calling processes child fields.
+    int child_pid = child_proc->pid;
+    addRunningChild(curr_proc, child_proc);
+
+    // Context switch to child_proc; copy over kernel stack and ctx in the process.
+    MakeProcessReady(curr_proc);
+    curr_proc->needs_copy = 1;
+    ContextSwitch(MySwitchFunc, curr_proc->ctx, curr_proc, child_proc);
+
+    // If the kernel stack could not be copied after all, we are still the caller; undo the child and fail.
+    if (curr_proc->needs_copy == 0) {
+        curr_proc->needs_copy = -1;
+        UnreadyProcess(curr_proc);
+        removeRunningChild(curr_proc, child_proc);
+        DestroyUnstartedPCB(child_proc);
+        FreeKernelArgs(kargs);
+        free(kfilename);
+        return ERROR;
+    }
+
+    // The caller just returns the child's PID; the child owns the copied arguments.
+    if (curr_proc->pid != child_pid) {
+        return child_pid;
+    }
+
+    // In the child: load the program straight into the empty address space.
+    int status = LoadProgram(kfilename, kargs, info);
+    FreeKernelArgs(kargs);
+    free(kfilename);
+
+    if (status != 0) {
+        HandleExit(ERROR);
+    }
+
+    return 0;
+}
+
 /* Handles the Exit system call.*/
 void HandleExit(int status) {
     TracePrintf(0, "HandleExit: entered by process (%d)\n", curr_proc->pid);
 
-    // Set flag that this process is terminated.
-    curr_proc->isTerminated = 1;
+    // Set state that this process is terminated.
+    curr_proc->state = PROC_TERMINATED;
 
     // TerminateProcess: handles all updating of orphaned children, parent, and ctx switches.
     TerminateProcess(curr_proc, status);
@@ -217,18 +322,26 @@ int HandleWait(int *status_ptr) {
     TracePrintf(0, "HandleWait: entered by process (%d)\n", curr_proc->pid);
 
     // Check if no remaining child processes - return ERROR.
-    if (IsLinkedListEmpty(curr_proc->exited_children) && IsLinkedListEmpty(curr_proc->running_children)) {
+    if (IsLinkedListEmpty(curr_proc->exited_children) && IsPCBQueueEmpty(&curr_proc->running_children)) {
         return ERROR;
     }
 
     // If there is children but none that has exited, then add to wait queue then block.
     if (IsLinkedListEmpty(curr_proc->exited_children) == 1) {
-        enqueueToList(wait_queue, curr_proc);
+        enqueuePCB(&wait_queue, curr_proc);
+        curr_proc->state = PROC_WAITING;
+        curr_proc->blocked_since = total_runningTime;
+        BoostPriority(curr_proc, 1);
         scheduleNextProcess();
     }
 
     TracePrintf(0, "HandleWait: found exited child of process (%d)\n", curr_proc->pid);
 
+    // Make sure status_ptr can be written (it may be a copy-on-write page) before collecting the child.
+    if (PrepareUserAccess(status_ptr, sizeof(int), 1) == ERROR) {
+        return ERROR;
+    }
+
     // We have case for collection of exited child process. First, take status-containing struct for exited child.
     exit_child_status* status_block = (exit_child_status *) dequeueFromList(curr_proc->exited_children);
 
@@ -260,9 +373,9 @@ int HandleBrk(void *addr) {
 
     TracePrintf(0, "HandleBrk: new_brk_pg is (%d) and curr_first_pg is (%d)\n", new_brk_pg, curr_first_pg);
 
-    // Cannot brk if not enough memory is available - overflows into stack,
-    // Or, in invalid mem region.
-    if (new_brk_pg - 1 >= curr_proc->uStack_bottom - 1 || new_brk_pg - 1 < MEM_INVALID_PAGES || new_brk_pg - curr_first_pg > (unsigned int) free_pframe_count) {
+    // Cannot brk if it overflows into stack, or is in invalid mem region.
+    // Physical memory is not checked here: heap pages only get frames when first touched (see FaultInPage).
+    if (new_brk_pg - 1 >= curr_proc->uStack_bottom - 1 || new_brk_pg - 1 < MEM_INVALID_PAGES) {
         TracePrintf(0, "HandleBrk: error with handle brk with number of pages (%d)\n", new_brk_pg - curr_first_pg);
         return ERROR;
     }
@@ -270,51 +383,30 @@ int HandleBrk(void *addr) {
     // Case 1: Move up brk (ie. addr > current brk)
     if ((unsigned long) addr > curr_proc->brk) {
         TracePrintf(0, "HandleBrk: case 1\n");
-        long free_page_pfn;
-
-        // Allocate free physical pages as needed.
-        unsigned int i;
-        for (i = curr_first_pg; i < new_brk_pg; i++) {
-            // Return error if we have no more physical pages left.
-            if ((free_page_pfn = AllocateFreePage()) < 0) {
-                return ERROR;
-            }
 
-            TracePrintf(0, "Allocated pfn (%d) for Brk()\n", free_page_pfn);
-
-            // Update brk position to right above current page.
-            curr_proc->brk = (i + 1) << PAGESHIFT;
-
-            // Otherwise, update process' page table as follows.
-            curr_proc->pgt_r0[i].pfn = (unsigned int) free_page_pfn;
-            curr_proc->pgt_r0[i].valid = 1;
-            curr_proc->pgt_r0[i].uprot = (PROT_READ | PROT_WRITE);
-            curr_proc->pgt_r0[i].kprot = (PROT_READ | PROT_WRITE);
-
-            // Must flush TBL for R0, since we mutated region 0.
-            WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
-        }
+        // Only reserve the range; TrapMemoryHandler maps zeroed pages on first touch.
+        curr_proc->brk = (unsigned long) new_brk_pg << PAGESHIFT;
     }
 
     // Case 2: Move down brk (ie. new_brk < current brk)
     else if ((unsigned long) addr < curr_proc->brk) {
         TracePrintf(0, "HandleBrk: case 2\n");
         unsigned int i;
-        // De-Allocate free physical pages as needed.
+        // De-Allocate the physical pages that were touched.
         for (i = curr_first_pg - 1; i >= new_brk_pg; i--) {
-            // Free the physical page.
-            FreePhysicalPage(curr_proc->pgt_r0[i].pfn);
-
-            // Update brk position to right above current page.
-            curr_proc->brk = i << PAGESHIFT;
-
-            // Update process' page table as follows.
-            curr_proc->pgt_r0[i].valid = 0;
+            if (curr_proc->pgt_r0[i].valid == 1) {
+                TLBInvalidate((unsigned long) i << PAGESHIFT);
+            }
 
-            // Must flush TBL for R0, since we mutated region 0.
-            WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+            // Free the physical page (or swap slot), and update process' page table.
+            ReleaseUserPage(curr_proc, i);
         }
 
+        // Update brk position to right above the last page kept.
+        curr_proc->brk = (unsigned long) new_brk_pg << PAGESHIFT;
+
+        // Must flush TBL for the freed pages, since we mutated region 0.
+        TLBFlushPending();
     }  
 
     // Case 3: (No Code) No change as new brk is same as before.
@@ -337,9 +429,15 @@ int HandleDelay(int clock_ticks) {
         return ERROR;
     }
 
-    // Now, if clock_ticks is valid, set delay in PCB and add it to delay queue.
+    // Now, if clock_ticks is valid, set delay in PCB and add it to delay heap.
     curr_proc->delay_until = total_runningTime + clock_ticks;
-    enqueueToList(delay_queue, curr_proc);
+    if (DelayHeapInsert(curr_proc) == ERROR) {
+        return ERROR;
+    }
+    curr_proc->state = PROC_DELAYED;
+
+    // Sleeping gives up the CPU voluntarily, so move up one level.
+    BoostPriority(curr_proc, 1);
 
     // Schedule next ready function.
     scheduleNextProcess();
@@ -361,38 +459,66 @@ int HandleTtyRead(int tty_id, void *buf, int len){
         return 0;
     }
 
-    // Block the calling process if there is no available input
-    if (readReady[tty_id] == -1) {
-        enqueueToList(readQueue[tty_id], curr_proc);
+    TtyInput *in = &inputRing[tty_id];
+
+    // Block the calling process until there is a line to read that is not spoken for by a reader already woken for
+    // it, so readers get lines in the order they blocked.
+    while (in->lines <= in->wakeups) {
+        enqueuePCB(&readQueue[tty_id], curr_proc);
+        curr_proc->state = PROC_READING;
+        curr_proc->blocked_since = total_runningTime;
+
+        // Waiting for terminal input means this is an interactive process, so it runs at the top level when input arrives.
+        BoostPriority(curr_proc, NUM_PRIORITY_LEVELS);
 
         // Schedule next process to run (ContextSwitch happens inside scheduleNextProcess)
         scheduleNextProcess();
+
+        // We were woken for a line, so our wakeup is no longer pending. If the line has gone (dropped by
+        // TTY_IN_DROP_OLDEST), we wait again.
+        in->wakeups--;
     }
 
-    // Came back from ContextSwtich, now we should have the text ready to read
-    textStruct* text = peekFromList(inputBuffer[tty_id]);
+    // Take the oldest line (or as much of it as fits), then as many more whole lines as fit in buf. An empty
+    // line (end of input) is only ever returned on its own.
+    int first_len = in->line_len[in->line_head];
+    int bytesToCopy = (len < first_len) ? len : first_len;
+    int whole_lines = (len < first_len) ? 0 : 1;
 
-    // Determine the number of bytes to copy
-    int bytesToCopy = (len < text->length) ? len : text->length;
+    // Lines spoken for by other woken readers are left to them.
+    while (whole_lines > 0 && first_len > 0 && whole_lines < in->lines - in->wakeups) {
+        int next_len = in->line_len[(in->line_head + whole_lines) % TTY_IN_MAX_LINES];
+        if (next_len == 0 || bytesToCopy + next_len > len) {
+            break;
+        }
+        bytesToCopy += next_len;
+        whole_lines++;
+    }
 
-    // Copy the available input to buf up to len bytes
-    memcpy(buf, text->line + text->ptr, bytesToCopy);
+    // Make sure buf can be written (it may be a copy-on-write page); the input stays buffered if not.
+    if (PrepareUserAccess(buf, bytesToCopy, 1) == ERROR) {
+        WakeTtyReaders(tty_id);
+        return ERROR;
+    }
 
-    // Update the ptr and length for any remaining bytes
-    text->ptr += bytesToCopy;
-    text->length -= bytesToCopy;
+    // Copy out of the ring (in two parts if it wraps).
+    int first = (bytesToCopy < TTY_IN_RING_SIZE - in->head) ? bytesToCopy : TTY_IN_RING_SIZE - in->head;
+    memcpy(buf, in->ring + in->head, first);
+    memcpy((char *) buf + first, in->ring, bytesToCopy - first);
+    in->head = (in->head + bytesToCopy) % TTY_IN_RING_SIZE;
+    in->count -= bytesToCopy;
 
-    // If all data has been read from this textStruct
-    if (text->length == 0) {
-        // Actually dequeue the textStruct from the Buffer list and remove it
-        text = dequeueFromList(inputBuffer[tty_id]);
-        free(text);
-        if (IsLinkedListEmpty(inputBuffer[tty_id])){
-            // All text has been read, reset the read-ready flag
-            readReady[tty_id] = -1;
-        }
+    // Drop the lines read whole; what is left of a partly read line stays first.
+    if (whole_lines == 0) {
+        in->line_len[in->line_head] -= bytesToCopy;
+    } else {
+        in->line_head = (in->line_head + whole_lines) % TTY_IN_MAX_LINES;
+        in->lines -= whole_lines;
     }
 
+    // What is left of a partly read line is free for the next reader in line.
+    WakeTtyReaders(tty_id);
+
     // Return the number of bytes actually copied
     return bytesToCopy;
 }
@@ -402,7 +528,7 @@ int HandleTtyWrite(int tty_id, void *buf, int len){
     TracePrintf(0, "HandleTtyWrite: entered by process (%d)\n", curr_proc->pid);
 
      // Validate parameters
-    if (tty_id < 0 || tty_id >= NUM_TERMINALS || buf == NULL || len < 0 || len > TERMINAL_MAX_LINE) {
+    if (tty_id < 0 || tty_id >= NUM_TERMINALS || buf == NULL || len < 0) {
         return ERROR;
     }
     
@@ -411,39 +537,108 @@ int HandleTtyWrite(int tty_id, void *buf, int len){
         return 0;
     }
 
-    // Copy the data from buf into curr_proc->writeRequest (from region 0 to region 1),
-    // since ContextSwitch below will invalidate the buf address
-    curr_proc->writeRequest = malloc(len * sizeof(char)); 
-    if (curr_proc->writeRequest == NULL) {
-        fprintf(stderr, "Memory allocation failed! at HandleTtyWrite()\n");
-        return ERROR;
+    TtyOutput *out = &outputRing[tty_id];
+    int done = 0;
+
+    // A write of up to a line goes into the ring whole. A longer one is streamed through the ring a piece at a
+    // time as the terminal drains it, and holds the terminal meanwhile so no other write lands in the middle.
+    while (done < len) {
+        int need = (len - done < TERMINAL_MAX_LINE) ? len - done : TERMINAL_MAX_LINE;
+
+        // Block while the ring is nearly full (or another write is streaming); TrapTransmitHandler wakes us
+        // once it has drained to the low water mark.
+        while (out->count >= TTY_OUT_HIGH_WATER || out->count + need > TTY_OUT_RING_SIZE
+               || (out->streamer != NULL && out->streamer != curr_proc)) {
+            TracePrintf(0, "HandleTtyWrite: output ring full, blocking process (%d)\n", curr_proc->pid);
+
+            enqueuePCB(&writeQueue[tty_id], curr_proc);
+            curr_proc->state = PROC_WRITING;
+            tty_write_blocks++;
+            scheduleNextProcess();
+        }
+
+        if (len > TERMINAL_MAX_LINE) {
+            out->streamer = curr_proc;
+        }
+
+        int piece = (len - done < TTY_OUT_RING_SIZE - out->count) ? len - done : TTY_OUT_RING_SIZE - out->count;
+
+        // Make sure this piece of buf is readable by this process (other processes may have run since the last one).
+        if (PrepareUserAccess((char *) buf + done, piece, 0) == ERROR) {
+            break;
+        }
+
+        // Copy the piece into the ring (in two parts if it wraps).
+        int tail = (out->head + out->count) % TTY_OUT_RING_SIZE;
+        int first = (piece < TTY_OUT_RING_SIZE - tail) ? piece : TTY_OUT_RING_SIZE - tail;
+        memcpy(out->ring + tail, (char *) buf + done, first);
+        memcpy(out->ring, (char *) buf + done + first, piece - first);
+        out->count += piece;
+        done += piece;
+
+        // If the terminal is idle, start sending now; otherwise the transmit handler gets to these bytes.
+        if (writeReady[tty_id] == 1) {
+            StartTtyTransmit(tty_id);
+        }
     }
-    memcpy(curr_proc->writeRequest, buf, len);
-    
-    // Record the writeLength for later use
-    curr_proc->writeLength = len;
 
-    if (writeReady[tty_id] == 1) {
-        // If the terminal is ready to be written to, write to hardware
-        TracePrintf(0, "HandleTtyWrite: immediately transmitting to terminal\n");
+    // Let the writers that waited for this one to finish have the terminal.
+    if (out->streamer == curr_proc) {
+        out->streamer = NULL;
+        while (!IsPCBQueueEmpty(&writeQueue[tty_id])) {
+            MakeProcessReady(dequeuePCB(&writeQueue[tty_id]));
+        }
+    }
+    tty_writes++;
 
-        // Mark the terminal as busy
-        writeReady[tty_id] = -1; 
-        transmitPCB[tty_id] = curr_proc;
-        TtyTransmit(tty_id, curr_proc->writeRequest, len);
+    TracePrintf(0, "HandleTtyWrite: returning len (%d)\n", done);
 
-    } else {
-        TracePrintf(0, "HandleTtyWrite: write not available, scheduling for later\n");
+    // If part of buf was unreadable, report how much was written, or ERROR if none was.
+    return (done > 0) ? done : ERROR;
+}
 
-        // Since terminal is not ready, enqueue this process in the write queue
-        enqueueToList(writeQueue[tty_id], curr_proc);
+/*
+ * Transmits up to TERMINAL_MAX_LINE bytes from the front of a terminal's
+ * output ring, which may hold several writes, and marks the terminal busy.
+ * The bytes are moved to the terminal's transmit buffer, so the ring space
+ * is free at once; if that brings the ring down to its low water mark,
+ * every blocked writer is made ready. Does nothing if the ring is empty.
+ */
+void StartTtyTransmit(int tty_id) {
+    TtyOutput *out = &outputRing[tty_id];
+
+    int n = (out->count < TERMINAL_MAX_LINE) ? out->count : TERMINAL_MAX_LINE;
+    if (n == 0) {
+        return;
     }
 
-    // Schedule next process to run
-    scheduleNextProcess();
-    
-    TracePrintf(0, "HandleTtyWrite: returning len (%d)\n", len);
+    int first = (n < TTY_OUT_RING_SIZE - out->head) ? n : TTY_OUT_RING_SIZE - out->head;
+    memcpy(out->xmit, out->ring + out->head, first);
+    memcpy(out->xmit + first, out->ring, n - first);
+    out->head = (out->head + n) % TTY_OUT_RING_SIZE;
+    out->count -= n;
+
+    writeReady[tty_id] = -1;
+    TtyTransmit(tty_id, out->xmit, n);
+    tty_transmits++;
 
-    // ContextSwitch back from TrapTransmitHandler, successfully write to the Terminal
-    return len; 
+    if (out->count <= TTY_OUT_LOW_WATER) {
+        while (!IsPCBQueueEmpty(&writeQueue[tty_id])) {
+            MakeProcessReady(dequeuePCB(&writeQueue[tty_id]));
+        }
+    }
+}
+
+/*
+ * Makes blocked readers of a terminal ready, oldest first, one for each
+ * buffered line that no reader has been woken for yet. They run when the
+ * scheduler picks them.
+ */
+void WakeTtyReaders(int tty_id) {
+    TtyInput *in = &inputRing[tty_id];
+
+    while (in->wakeups < in->lines && !IsPCBQueueEmpty(&readQueue[tty_id])) {
+        MakeProcessReady(dequeuePCB(&readQueue[tty_id]));
+        in->wakeups++;
+    }
 }
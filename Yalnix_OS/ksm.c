@@ -0,0 +1,162 @@
+#include "function.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include </clear/courses/comp421/pub/include/comp421/yalnix.h>
+#include </clear/courses/comp421/pub/include/comp421/hardware.h>
+#include </clear/courses/comp421/pub/include/comp421/loadinfo.h>
+
+/*
+ * Empties the table of pages recorded by the merging scanner.
+ */
+void InitKsm() {
+    int i;
+    for (i = 0; i < KSM_TABLE_SIZE; i++) {
+        ksm_table[i].pfn = NO_FRAME;
+    }
+}
+
+/*
+ * Returns the FNV-1a hash of the contents of frame pfn, and sets *is_zero if
+ * every byte of it is zero.
+ */
+unsigned long HashFrame(unsigned long pfn, int *is_zero) {
+    unsigned char *page = (unsigned char *) KMap(pfn);
+    unsigned long hash = 2166136261UL;
+    unsigned char any = 0;
+    int i;
+
+    for (i = 0; i < PAGESIZE; i++) {
+        hash = (hash ^ page[i]) * 16777619UL;
+        any |= page[i];
+    }
+    KUnmap(page);
+
+    *is_zero = (any == 0);
+    return hash;
+}
+
+/*
+ * Returns 1 if the frames a and b hold the same bytes, 0 if not.
+ */
+int SameFrame(unsigned long a, unsigned long b) {
+    char *page_a = (char *) KMap(a);
+    char *page_b = (char *) KMap(b);
+    int same = (memcmp(page_a, page_b, PAGESIZE) == 0);
+    KUnmap(page_b);
+    KUnmap(page_a);
+
+    ksm_bytes_compared += PAGESIZE;
+    return same;
+}
+
+/*
+ * Makes a resident writable page read-only and copy-on-write, so it can
+ * share its frame; the first write gives it a private copy again. The page
+ * belongs to a process that is not running, so there is no TLB entry to
+ * flush.
+ */
+void KsmProtectPage(struct pte *pte) {
+    if (pte->uprot & PROT_WRITE) {
+        pte->uprot &= ~PROT_WRITE;
+        pte->kprot &= ~PROT_WRITE;
+        pte->unused |= PTE_COW;
+    }
+}
+
+/*
+ * Looks at region 0 page vpn of pcb for a frame to merge it with. An all-zero
+ * page maps the shared zero frame. Otherwise the page's hash picks an entry
+ * of ksm_table; if the page recorded there is still mapped by its owner and
+ * holds the same bytes, both pages share that frame read-only and
+ * copy-on-write and this page's frame is freed. If not, this page takes over
+ * the entry. Returns 1 if a frame was freed, 0 if not.
+ */
+int KsmMergePage(PCB *pcb, unsigned long vpn) {
+    struct pte *pte = &pcb->pgt_r0[vpn];
+    int is_zero;
+
+    unsigned long hash = HashFrame(pte->pfn, &is_zero);
+    ksm_pages_scanned++;
+
+    if (is_zero) {
+        KsmProtectPage(pte);
+        FreePhysicalPage(pte->pfn);
+        pte->pfn = (unsigned int) zero_pfn;
+        pcb->resident_pages--;
+        ksm_zero_merges++;
+        return 1;
+    }
+
+    KsmEntry *entry = &ksm_table[hash % KSM_TABLE_SIZE];
+
+    // The entry is only trusted if its owner still maps the frame; otherwise the frame may have been freed and reused.
+    PCB *owner = FindProcess(entry->owner_pid);
+    if (entry->pfn != NO_FRAME && entry->hash == hash && entry->pfn != (long) pte->pfn
+        && owner != NULL && owner != curr_proc && owner->state != PROC_TERMINATED
+        && owner->pgt_r0[entry->owner_vpn].valid == 1 && (long) owner->pgt_r0[entry->owner_vpn].pfn == entry->pfn
+        && SameFrame((unsigned long) entry->pfn, pte->pfn)) {
+        KsmProtectPage(&owner->pgt_r0[entry->owner_vpn]);
+        KsmProtectPage(pte);
+
+        FreePhysicalPage(pte->pfn);
+        ShareFrame((unsigned int) entry->pfn);
+        pte->pfn = (unsigned int) entry->pfn;
+
+        ksm_merges++;
+        TracePrintf(0, "KsmMergePage: page (%d) of process (%d) now shares pfn (%d) with process (%d).\n",
+            vpn, pcb->pid, entry->pfn, owner->pid);
+        return 1;
+    }
+
+    entry->hash = hash;
+    entry->pfn = (long) pte->pfn;
+    entry->owner_pid = pcb->pid;
+    entry->owner_vpn = vpn;
+
+    return 0;
+}
+
+/*
+ * Scans up to KSM_SCAN_BATCH user pages for identical pages to merge, going
+ * on from where the last scan stopped through the region 0 page tables of
+ * every process. Called on clock ticks while the idle process runs, so no
+ * scanned process is running. Only private pages that are writable (or
+ * copy-on-write) are candidates; text is shared already.
+ */
+void KsmScan() {
+    struct timeval start, end;
+    int scanned = 0;
+    int slots = 0;
+
+    gettimeofday(&start, NULL);
+
+    while (scanned < KSM_SCAN_BATCH && slots <= PROC_TABLE_SIZE) {
+        PCB *pcb = proc_table[ksm_hand_slot];
+
+        if (pcb == NULL || pcb == curr_proc || pcb->state == PROC_TERMINATED
+            || (ksm_hand_vpn = NextUsedPage(pcb, ksm_hand_vpn)) >= USER_PAGES) {
+            ksm_hand_slot = (ksm_hand_slot + 1) % PROC_TABLE_SIZE;
+            ksm_hand_vpn = MEM_INVALID_PAGES;
+            slots++;
+            continue;
+        }
+
+        struct pte *pte = &pcb->pgt_r0[ksm_hand_vpn];
+        if (pte->valid == 1 && (long) pte->pfn != zero_pfn && frame_refcount[pte->pfn] == 1
+            && ((pte->uprot & PROT_WRITE) || (pte->unused & PTE_COW))) {
+            KsmMergePage(pcb, ksm_hand_vpn);
+            scanned++;
+        }
+
+        ksm_hand_vpn++;
+    }
+
+    gettimeofday(&end, NULL);
+    ksm_scan_usec += (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+}
@@ -217,4 +217,121 @@ void printLinkedList(LinkedList* list) {
         }
         current = current->next; // Move to the next node
     }
-}
\ No newline at end of file
+}
+
+/* *************************** PCB Queue *************************** */
+
+/* 
+ * Append the PCB to the tail of the queue. The PCB must not already be in a queue.
+ */
+void enqueuePCB(PCBQueue* queue, PCB* pcb) {
+    pcb->q_next = NULL;
+    pcb->q_prev = queue->tail;
+    pcb->q_owner = queue;
+
+    if (queue->tail == NULL) {
+        queue->head = pcb;
+    } else {
+        queue->tail->q_next = pcb;
+    }
+    queue->tail = pcb;
+}
+
+/* 
+ * Pop the head PCB from the queue. Returns NULL if the queue is empty.
+ */
+PCB* dequeuePCB(PCBQueue* queue) {
+    PCB* pcb = queue->head;
+    if (pcb != NULL) {
+        removePCB(pcb);
+    }
+    return pcb;
+}
+
+// Return the front (oldest) PCB of the queue without removing it, or NULL if empty.
+PCB* peekPCB(PCBQueue* queue) {
+    return queue->head;
+}
+
+/* 
+ * Unlink the PCB from whichever queue holds it, in constant time.
+ * Does nothing if the PCB is not in a queue.
+ */
+void removePCB(PCB* pcb) {
+    PCBQueue* queue = pcb->q_owner;
+    if (queue == NULL) {
+        return;
+    }
+
+    if (pcb->q_prev == NULL) {
+        queue->head = pcb->q_next;
+    } else {
+        pcb->q_prev->q_next = pcb->q_next;
+    }
+
+    if (pcb->q_next == NULL) {
+        queue->tail = pcb->q_prev;
+    } else {
+        pcb->q_next->q_prev = pcb->q_prev;
+    }
+
+    pcb->q_next = NULL;
+    pcb->q_prev = NULL;
+    pcb->q_owner = NULL;
+}
+
+// Returns 1 if the queue is empty, otherwise returns 0.
+int IsPCBQueueEmpty(PCBQueue* queue) {
+    return (queue->head == NULL) ? 1 : 0;
+}
+
+/* 
+ * Moves every PCB of src onto the tail of dst, keeping their order, and
+ * leaves src empty. Each moved PCB's owner is updated.
+ */
+void appendPCBQueue(PCBQueue* dst, PCBQueue* src) {
+    PCB* pcb;
+    while ((pcb = dequeuePCB(src)) != NULL) {
+        enqueuePCB(dst, pcb);
+    }
+}
+
+/* 
+ * Append the child to the tail of the parent's running_children. Uses the
+ * sibling links, so the child can be in a scheduling queue at the same time.
+ */
+void addRunningChild(PCB* parent, PCB* child) {
+    PCBQueue* children = &parent->running_children;
+
+    child->sibling_next = NULL;
+    child->sibling_prev = children->tail;
+
+    if (children->tail == NULL) {
+        children->head = child;
+    } else {
+        children->tail->sibling_next = child;
+    }
+    children->tail = child;
+}
+
+/* 
+ * Unlink the child from the parent's running_children in constant time.
+ */
+void removeRunningChild(PCB* parent, PCB* child) {
+    PCBQueue* children = &parent->running_children;
+
+    if (child->sibling_prev == NULL) {
+        children->head = child->sibling_next;
+    } else {
+        child->sibling_prev->sibling_next = child->sibling_next;
+    }
+
+    if (child->sibling_next == NULL) {
+        children->tail = child->sibling_prev;
+    } else {
+        child->sibling_next->sibling_prev = child->sibling_prev;
+    }
+
+    child->sibling_next = NULL;
+    child->sibling_prev = NULL;
+}
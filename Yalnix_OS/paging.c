@@ -0,0 +1,534 @@
+#include "function.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include </clear/courses/comp421/pub/include/comp421/yalnix.h>
+#include </clear/courses/comp421/pub/include/comp421/hardware.h>
+#include </clear/courses/comp421/pub/include/comp421/loadinfo.h>
+
+/*
+ * Gives the current process a private, writable copy of region 0 page vpn,
+ * which must be a valid copy-on-write page. If no other process shares the
+ * frame any more, the frame is simply made writable again; otherwise the
+ * page is copied into a new frame. Returns 0 on success, ERROR if there is
+ * no free frame for the copy.
+ */
+int BreakCopyOnWrite(unsigned int vpn) {
+    struct pte *pte = &curr_proc->pgt_r0[vpn];
+
+    TracePrintf(0, "BreakCopyOnWrite: process (%d) writing to shared page (%d), pfn (%d).\n", curr_proc->pid, vpn, pte->pfn);
+
+    if ((long) pte->pfn == zero_pfn || frame_refcount[pte->pfn] > 1) {
+        // A zero page just needs a zeroed frame; otherwise copy the old frame into the new one.
+        int is_zero = ((long) pte->pfn == zero_pfn);
+        long new_pfn = is_zero ? AllocateZeroedPage() : AllocateFreePage();
+        if (new_pfn < 0) {
+            TracePrintf(0, "BreakCopyOnWrite: no free frame to copy page (%d).\n", vpn);
+            return ERROR;
+        }
+
+        if (!is_zero) {
+            CopyFrame((unsigned long) new_pfn, pte->pfn);
+        }
+
+        // Drop this process's share of the old frame.
+        FreePhysicalPage(pte->pfn);
+        pte->pfn = (unsigned int) new_pfn;
+        if (is_zero) {
+            curr_proc->resident_pages++;
+        }
+    }
+
+    // The page is private now, so give back the write permission fork took away.
+    pte->uprot |= PROT_WRITE;
+    pte->kprot |= PROT_WRITE;
+    pte->unused &= ~PTE_COW;
+
+    TLBFlushAddress((unsigned long) vpn << PAGESHIFT);
+
+    return 0;
+}
+
+/*
+ * Allocates and zeroes the frame that every untouched zero page maps. Its
+ * reference count stays 0, so Exec never counts it as memory it would free.
+ * Halts if there is no frame for it.
+ */
+void InitZeroFrame() {
+    if ((zero_pfn = AllocateFreePage()) < 0) {
+        printf("Not enough physical memory for the zero frame.\n");
+        Halt();
+    }
+    frame_refcount[zero_pfn] = 0;
+
+    ZeroFrame((unsigned long) zero_pfn);
+}
+
+/*
+ * Allocates a frame filled with zeros, taking one zeroed ahead of time from
+ * the pool if there is one. Returns its frame number, or -1 if there is no
+ * free frame.
+ */
+long AllocateZeroedPage() {
+    long pfn;
+
+    if (zero_pool_count > 0) {
+        pfn = zero_pool[--zero_pool_count];
+        free_pframe_count--;
+        frame_refcount[pfn] = 1;
+        zero_pool_hits++;
+        return pfn;
+    }
+
+    if ((pfn = AllocateFreePage()) < 0) {
+        return (-1);
+    }
+    ZeroFrame((unsigned long) pfn);
+    zero_pool_misses++;
+
+    return pfn;
+}
+
+/*
+ * Zeroes up to ZERO_POOL_BATCH free frames into the zeroed pool, keeping it
+ * at most ZERO_POOL_SIZE deep. Called on clock ticks while the idle process
+ * runs, so the zeroing happens when there is nothing else to do. Frames
+ * come only from the free list and the never-used frames, and stay counted
+ * as free; it stops when those run out.
+ */
+void RefillZeroPool() {
+    int batch;
+    for (batch = 0; batch < ZERO_POOL_BATCH && zero_pool_count < ZERO_POOL_SIZE; batch++) {
+        // Only take plain free frames: not ones in the pool already, and never by reclaiming user pages.
+        long pfn = TakeFreeFrame();
+        if (pfn < 0) {
+            break;
+        }
+
+        ZeroFrame((unsigned long) pfn);
+        zero_pool[zero_pool_count++] = pfn;
+    }
+
+    TracePrintf(0, "RefillZeroPool: (%d) zeroed frames ready.\n", zero_pool_count);
+}
+
+/*
+ * Maps region 0 page vpn of the current process to the shared zero frame,
+ * read-only and copy-on-write, so it reads as zeros and gets a private frame
+ * on its first write. The caller flushes the TLB.
+ */
+void MapZeroPage(unsigned long vpn) {
+    struct pte *pte = &curr_proc->pgt_r0[vpn];
+
+    pte->pfn = (unsigned int) zero_pfn;
+    pte->uprot = PROT_READ;
+    pte->kprot = PROT_READ;
+    pte->unused = PTE_COW;
+    pte->valid = 1;
+
+    MarkPageUsed(curr_proc, vpn);
+}
+
+/*
+ * Records in pcb's page map that user page vpn is in use. Every pte that
+ * becomes valid or tagged is marked, so code that visits a process's pages
+ * (Fork, Exec, exit, the page scanners) only looks at marked ones.
+ */
+void MarkPageUsed(PCB *pcb, unsigned long vpn) {
+    pcb->page_map[vpn / 32] |= (1u << (vpn % 32));
+}
+
+/*
+ * Records in pcb's page map that user page vpn is empty again.
+ */
+void MarkPageUnused(PCB *pcb, unsigned long vpn) {
+    pcb->page_map[vpn / 32] &= ~(1u << (vpn % 32));
+}
+
+/*
+ * Returns the first user page at or after vpn that pcb's page map marks in
+ * use, or USER_PAGES if there is none. Empty words of the map are skipped
+ * whole.
+ */
+unsigned long NextUsedPage(PCB *pcb, unsigned long vpn) {
+    while (vpn < USER_PAGES) {
+        unsigned int bits = pcb->page_map[vpn / 32] >> (vpn % 32);
+        if (bits != 0) {
+            vpn += __builtin_ctz(bits);
+            return (vpn < USER_PAGES) ? vpn : USER_PAGES;
+        }
+        vpn = (vpn / 32 + 1) * 32;
+    }
+    return USER_PAGES;
+}
+
+/*
+ * Makes region 0 page vpn of the current process present if it is an invalid
+ * page the process is entitled to. A page the swap clock invalidated is just
+ * made valid again, and a swapped-out or compressed page is read back from
+ * the swap file or decompressed (see swap.c and zram.c). A text or data page not loaded yet (PTE_FILE) is read from
+ * the process's program image, zero-filling whatever the file does not
+ * cover; any other page between MEM_INVALID_SIZE and brk (bss, or heap not
+ * touched since Brk reserved it) maps the zero frame. Returns 0 if the page
+ * is now valid, ERROR if vpn is not such a page, there is no free frame for
+ * it or the program or swap file cannot be read.
+ */
+int FaultInPage(unsigned long vpn) {
+    struct pte *pte = &curr_proc->pgt_r0[vpn];
+
+    if (pte->valid == 1) {
+        return 0;
+    }
+
+    // The swap clock was checking whether the page is still used; it is, so it stays resident.
+    if (pte->unused & PTE_UNREF) {
+        pte->unused &= ~PTE_UNREF;
+        pte->valid = 1;
+        swap_rescues++;
+
+        TLBFlushAddress(vpn << PAGESHIFT);
+        return 0;
+    }
+
+    // Any user page (stack too) may have been written out or compressed.
+    if (pte->unused & PTE_SWAP) {
+        return SwapInPage(vpn);
+    }
+    if (pte->unused & PTE_ZRAM) {
+        return ZramLoadPage(vpn);
+    }
+
+    if (vpn < MEM_INVALID_PAGES || vpn >= ((unsigned long) UP_TO_PAGE(curr_proc->brk) >> PAGESHIFT)) {
+        return ERROR;
+    }
+
+    ProgramImage *image = curr_proc->image;
+    unsigned long image_page = pte->pfn;
+    int is_text = (pte->unused & PTE_FILE) && image_page < image->text_npg;
+
+    // Text is the same for every process running the program, so map the frame another one already read.
+    if (is_text && image->text_pfn[image_page] != NO_FRAME) {
+        ShareFrame((unsigned int) image->text_pfn[image_page]);
+        pte->pfn = (unsigned int) image->text_pfn[image_page];
+        pte->unused = 0;
+        pte->valid = 1;
+        curr_proc->resident_pages++;
+
+        TLBFlushAddress(vpn << PAGESHIFT);
+
+        TracePrintf(0, "FaultInPage: mapped shared text pfn (%d) at page (%d) for process (%d).\n", pte->pfn, vpn, curr_proc->pid);
+        return 0;
+    }
+
+    // A zero page costs no frame until it is written.
+    if ((pte->unused & PTE_FILE) == 0) {
+        MapZeroPage(vpn);
+        TLBFlushAddress(vpn << PAGESHIFT);
+
+        TracePrintf(0, "FaultInPage: mapped zero frame at page (%d) for process (%d).\n", vpn, curr_proc->pid);
+        return 0;
+    }
+
+    long pfn;
+    if ((pfn = AllocateFreePage()) < 0) {
+        TracePrintf(0, "FaultInPage: no free frame for page (%d).\n", vpn);
+        return ERROR;
+    }
+
+    char *frame = (char *) KMap((unsigned long) pfn);
+
+    // Read this page's part of the file; the protections were set by LoadProgram.
+    unsigned long page_offset = image_page << PAGESHIFT;
+    unsigned long len = 0;
+
+    if (page_offset < image->file_size) {
+        len = image->file_size - page_offset;
+        if (len > PAGESIZE) {
+            len = PAGESIZE;
+        }
+    }
+
+    if (image->cached != NULL) {
+        memcpy(frame, image->cached->bytes + page_offset, len);
+    } else if (len > 0 && (lseek(image->fd, image->file_offset + page_offset, SEEK_SET) < 0
+                           || read(image->fd, frame, len) != (long) len)) {
+        TracePrintf(0, "FaultInPage: couldn't read page (%d) of program image.\n", vpn);
+        KUnmap(frame);
+        FreePhysicalPage((unsigned int) pfn);
+        return ERROR;
+    }
+    memset(frame + len, 0, PAGESIZE - len);
+    KUnmap(frame);
+
+    // The image keeps its own reference to a text frame, for the next process that needs the page.
+    if (is_text) {
+        image->text_pfn[image_page] = pfn;
+        ShareFrame((unsigned int) pfn);
+    }
+
+    pte->pfn = (unsigned int) pfn;
+    pte->unused = 0;
+    pte->valid = 1;
+    curr_proc->resident_pages++;
+
+    TLBFlushAddress(vpn << PAGESHIFT);
+
+    TracePrintf(0, "FaultInPage: mapped pfn (%d) at page (%d) for process (%d).\n", pfn, vpn, curr_proc->pid);
+
+    return 0;
+}
+
+/*
+ * Returns the image of a program whose header is li, with its text and data
+ * in the image cache entry cached or, if cached is NULL, in the file open at
+ * fd just after the header. If a process is already running the same file
+ * (same device, inode, size and modification time), its image is shared and
+ * fd is closed; otherwise a new image is created, takes over fd (or uses
+ * cached) and is added to image_registry. Returns NULL, leaving fd open, if
+ * the file cannot be examined or there is no memory for a new image.
+ */
+ProgramImage *GetProgramImage(int fd, ImageCacheEntry *cached, struct loadinfo *li) {
+    unsigned long dev, ino, size;
+    long mtime;
+
+    if (cached != NULL) {
+        dev = cached->dev;
+        ino = cached->ino;
+        size = cached->size;
+        mtime = cached->mtime;
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            return NULL;
+        }
+        dev = (unsigned long) st.st_dev;
+        ino = (unsigned long) st.st_ino;
+        size = (unsigned long) st.st_size;
+        mtime = (long) st.st_mtime;
+    }
+
+    ProgramImage *image;
+    for (image = image_registry; image != NULL; image = image->next) {
+        if (image->dev == dev && image->ino == ino && image->size == size && image->mtime == mtime) {
+            TracePrintf(0, "GetProgramImage: sharing loaded image (%d users).\n", image->refcount);
+            image->refcount++;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return image;
+        }
+    }
+
+    image = (ProgramImage *) malloc(sizeof(ProgramImage));
+    if (image == NULL) {
+        return NULL;
+    }
+
+    image->text_npg = li->text_size >> PAGESHIFT;
+    image->text_pfn = NULL;
+    if (image->text_npg > 0 && (image->text_pfn = (long *) malloc(image->text_npg * sizeof(long))) == NULL) {
+        free(image);
+        return NULL;
+    }
+
+    unsigned long i;
+    for (i = 0; i < image->text_npg; i++) {
+        image->text_pfn[i] = NO_FRAME;
+    }
+
+    image->fd = fd;
+    image->cached = cached;
+    image->dev = dev;
+    image->ino = ino;
+    image->size = size;
+    image->mtime = mtime;
+    image->file_offset = (cached != NULL) ? 0 : (unsigned long) lseek(fd, 0, SEEK_CUR);
+    image->file_size = li->text_size + li->data_size;
+    image->refcount = 1;
+
+    // The cache entry cannot be evicted while this image reads from it.
+    if (cached != NULL) {
+        cached->users++;
+    }
+
+    image->next = image_registry;
+    image_registry = image;
+
+    return image;
+}
+
+/*
+ * Adds a user to a program image, for a child that inherits its parent's
+ * not yet loaded pages.
+ */
+void ShareProgramImage(ProgramImage *image) {
+    if (image != NULL) {
+        image->refcount++;
+    }
+}
+
+/*
+ * Drops a user of a program image (on Exec or exit). When the last user is
+ * gone, the image leaves image_registry, drops its references to the text
+ * frames, closes its file (or lets its cache entry be evicted) and is freed.
+ */
+void ReleaseProgramImage(ProgramImage *image) {
+    if (image == NULL || --image->refcount > 0) {
+        return;
+    }
+
+    ProgramImage **link = &image_registry;
+    while (*link != image) {
+        link = &(*link)->next;
+    }
+    *link = image->next;
+
+    unsigned long i;
+    for (i = 0; i < image->text_npg; i++) {
+        if (image->text_pfn[i] != NO_FRAME) {
+            FreePhysicalPage((unsigned int) image->text_pfn[i]);
+        }
+    }
+
+    free(image->text_pfn);
+    if (image->cached != NULL) {
+        image->cached->users--;
+    } else {
+        close(image->fd);
+    }
+    free(image);
+}
+
+/*
+ * Checks that the current process may access the user buffer [addr, addr + len)
+ * and gets it ready for the kernel to touch. If write is set, every page must be
+ * writable by the user and shared copy-on-write pages are made private first,
+ * since the kernel's own write would otherwise go to every sharer. Must be called
+ * right before the kernel touches the buffer, with no blocking in between.
+ * Returns 0 if the whole buffer is accessible, ERROR otherwise.
+ */
+int PrepareUserAccess(void *addr, unsigned long len, int write) {
+    if (len == 0) {
+        return 0;
+    }
+
+    unsigned long first_vpn = DOWN_TO_PAGE((unsigned long) addr) >> PAGESHIFT;
+    unsigned long last_vpn = DOWN_TO_PAGE((unsigned long) addr + len - 1) >> PAGESHIFT;
+
+    // The buffer must lie entirely in the user part of region 0.
+    if ((unsigned long) addr + len < (unsigned long) addr || last_vpn >= (USER_STACK_LIMIT >> PAGESHIFT)) {
+        return ERROR;
+    }
+
+    unsigned long vpn;
+    for (vpn = first_vpn; vpn <= last_vpn; vpn++) {
+        struct pte *pte = &curr_proc->pgt_r0[vpn];
+
+        // Heap pages not touched yet are mapped now, as the user's own access would.
+        if (pte->valid == 0 && FaultInPage(vpn) == ERROR) {
+            return ERROR;
+        }
+
+        if ((pte->uprot & PROT_READ) == 0) {
+            return ERROR;
+        }
+
+        if (write) {
+            if (pte->unused & PTE_COW) {
+                if (BreakCopyOnWrite(vpn) == ERROR) {
+                    return ERROR;
+                }
+            } else if ((pte->uprot & PROT_WRITE) == 0) {
+                return ERROR;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Copies the NUL-terminated user string str into the kernel heap, checking
+ * each page of it before reading. Returns the copy, or NULL if the string is
+ * not readable or there is no memory for the copy.
+ */
+char *CopyUserString(char *str) {
+    unsigned long len = 0;
+
+    // Check one page at a time, scanning for the terminator within it.
+    while (1) {
+        if (PrepareUserAccess(str + len, 1, 0) == ERROR) {
+            return NULL;
+        }
+
+        unsigned long page_end = UP_TO_PAGE((unsigned long) (str + len) + 1);
+        while ((unsigned long) (str + len) < page_end && str[len] != '\0') {
+            len++;
+        }
+
+        if ((unsigned long) (str + len) < page_end) {
+            break;
+        }
+    }
+
+    char *copy = (char *) malloc(len + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, str, len + 1);
+
+    return copy;
+}
+
+/*
+ * Copies the NULL-terminated user argv array and every string in it into the
+ * kernel heap, so they survive a switch to another address space. Returns the
+ * NULL-terminated copy, or NULL on a bad pointer or lack of memory.
+ */
+char **CopyUserArgs(char **argvec) {
+    int argc = 0;
+
+    // Count the arguments, checking each pointer slot before reading it.
+    while (1) {
+        if (PrepareUserAccess(&argvec[argc], sizeof(char *), 0) == ERROR) {
+            return NULL;
+        }
+        if (argvec[argc] == NULL) {
+            break;
+        }
+        argc++;
+    }
+
+    char **args = (char **) malloc((argc + 1) * sizeof(char *));
+    if (args == NULL) {
+        return NULL;
+    }
+
+    int i;
+    for (i = 0; i < argc; i++) {
+        if ((args[i] = CopyUserString(argvec[i])) == NULL) {
+            args[i] = NULL;
+            FreeKernelArgs(args);
+            return NULL;
+        }
+    }
+    args[argc] = NULL;
+
+    return args;
+}
+
+/*
+ * Frees an argv array built by CopyUserArgs, including its strings.
+ */
+void FreeKernelArgs(char **args) {
+    int i;
+    for (i = 0; args[i] != NULL; i++) {
+        free(args[i]);
+    }
+    free(args);
+}
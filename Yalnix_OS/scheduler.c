@@ -0,0 +1,185 @@
+#include "function.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include </clear/courses/comp421/pub/include/comp421/yalnix.h>
+#include </clear/courses/comp421/pub/include/comp421/hardware.h>
+#include </clear/courses/comp421/pub/include/comp421/loadinfo.h>
+
+// Clock ticks a process may run at each level before it is preempted. Lower levels get longer slices.
+const unsigned int level_quantum[NUM_PRIORITY_LEVELS] = {1, 2, 4, 8};
+
+/*
+ * Adds a process to the tail of the ready queue for its priority level and
+ * marks that level as non-empty. The idle process is never queued.
+ */
+void MakeProcessReady(PCB *pcb) {
+    if (pcb == NULL || pcb == idle_pcb) {
+        return;
+    }
+
+    enqueuePCB(&readyQueue[pcb->priority], pcb);
+    ready_bitmap |= (1u << pcb->priority);
+    pcb->state = PROC_READY;
+
+    TracePrintf(0, "MakeProcessReady: process (%d) ready at level (%d).\n", pcb->pid, pcb->priority);
+}
+
+/*
+ * Returns the highest priority level (lowest number) that has a ready
+ * process, or NUM_PRIORITY_LEVELS if every ready queue is empty.
+ */
+int HighestReadyPriority() {
+    if (ready_bitmap == 0) {
+        return NUM_PRIORITY_LEVELS;
+    }
+    return __builtin_ctz(ready_bitmap);
+}
+
+/*
+ * Removes and returns the next process to run, taken from the head of the
+ * highest non-empty level. Returns NULL if no process is ready. The chosen
+ * process starts a fresh time slice at the level it was taken from.
+ */
+PCB* PickNextReady() {
+    int level = HighestReadyPriority();
+    if (level == NUM_PRIORITY_LEVELS) {
+        return NULL;
+    }
+
+    PCB *pcb = dequeuePCB(&readyQueue[level]);
+
+    // Clear the level's bit once its queue drains.
+    if (IsPCBQueueEmpty(&readyQueue[level])) {
+        ready_bitmap &= ~(1u << level);
+    }
+
+    pcb->priority = level;
+    pcb->runningTime = 0;
+
+    return pcb;
+}
+
+/*
+ * Raises a process by the given number of levels (towards 0). Called when a
+ * process blocks, so I/O-bound processes are favoured when they wake up.
+ */
+void BoostPriority(PCB *pcb, int levels) {
+    pcb->priority = (pcb->priority > levels) ? pcb->priority - levels : 0;
+}
+
+/*
+ * Lowers a process by one level. Called when a process uses up its whole
+ * time slice, so CPU-bound processes drift to longer, less frequent slices.
+ */
+void DemotePriority(PCB *pcb) {
+    if (pcb->priority < NUM_PRIORITY_LEVELS - 1) {
+        pcb->priority++;
+    }
+}
+
+/*
+ * Moves every ready process to the top level so demoted processes cannot
+ * starve. PickNextReady fixes up each process's level when it is chosen.
+ */
+void BoostAllReady() {
+    int level;
+    for (level = 1; level < NUM_PRIORITY_LEVELS; level++) {
+        appendPCBQueue(&readyQueue[0], &readyQueue[level]);
+    }
+
+    if (ready_bitmap != 0) {
+        ready_bitmap = 1u;
+    }
+}
+
+/*
+ * Takes a process back off its ready queue and marks it running again.
+ * Used when a switch away from the current process fails and it carries on.
+ */
+void UnreadyProcess(PCB *pcb) {
+    PCBQueue *queue = pcb->q_owner;
+    removePCB(pcb);
+
+    // The process may have been moved to another level by BoostAllReady, so find the level from its queue.
+    if (queue != NULL && IsPCBQueueEmpty(queue)) {
+        ready_bitmap &= ~(1u << (queue - readyQueue));
+    }
+    pcb->state = PROC_RUNNING;
+}
+
+/*
+ * Inserts a delayed process into the delay heap, ordered by delay_until.
+ * Grows the heap by doubling when it is full. Returns 0 on success, ERROR if
+ * the heap could not be grown.
+ */
+int DelayHeapInsert(PCB *pcb) {
+    if (delay_heap_size == delay_heap_capacity) {
+        PCB **bigger = (PCB **) realloc(delay_heap, 2 * delay_heap_capacity * sizeof(PCB *));
+        if (bigger == NULL) {
+            TracePrintf(0, "DelayHeapInsert: cannot grow delay heap.\n");
+            return ERROR;
+        }
+        delay_heap = bigger;
+        delay_heap_capacity *= 2;
+    }
+
+    // Sift the new entry up from the bottom of the heap.
+    int i = delay_heap_size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (delay_heap[parent]->delay_until <= pcb->delay_until) {
+            break;
+        }
+        delay_heap[i] = delay_heap[parent];
+        i = parent;
+    }
+    delay_heap[i] = pcb;
+
+    return 0;
+}
+
+/*
+ * Returns the delayed process with the earliest deadline without removing it,
+ * or NULL if no process is delayed.
+ */
+PCB* DelayHeapPeek() {
+    if (delay_heap_size == 0) {
+        return NULL;
+    }
+    return delay_heap[0];
+}
+
+/*
+ * Removes and returns the delayed process with the earliest deadline, or NULL
+ * if no process is delayed.
+ */
+PCB* DelayHeapPop() {
+    if (delay_heap_size == 0) {
+        return NULL;
+    }
+
+    PCB *top = delay_heap[0];
+    PCB *last = delay_heap[--delay_heap_size];
+
+    // Sift the last entry down from the root.
+    int i = 0;
+    while (2 * i + 1 < delay_heap_size) {
+        int child = 2 * i + 1;
+        if (child + 1 < delay_heap_size && delay_heap[child + 1]->delay_until < delay_heap[child]->delay_until) {
+            child++;
+        }
+        if (last->delay_until <= delay_heap[child]->delay_until) {
+            break;
+        }
+        delay_heap[i] = delay_heap[child];
+        i = child;
+    }
+    delay_heap[i] = last;
+
+    return top;
+}
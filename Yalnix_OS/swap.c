@@ -0,0 +1,256 @@
+#include "function.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include </clear/courses/comp421/pub/include/comp421/yalnix.h>
+#include </clear/courses/comp421/pub/include/comp421/hardware.h>
+#include </clear/courses/comp421/pub/include/comp421/loadinfo.h>
+
+/*
+ * Creates the swap file on the host and the table of its slots. If either
+ * fails the kernel runs without swap, as before: allocations fail once the
+ * physical frames run out.
+ */
+void InitSwap() {
+    swap_slot_refcount = (unsigned short *) calloc(SWAP_SLOTS, sizeof(unsigned short));
+    if (swap_slot_refcount == NULL) {
+        TracePrintf(0, "InitSwap: no memory for swap slot table, running without swap.\n");
+        return;
+    }
+
+    if ((swap_fd = open(SWAP_FILE_NAME, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+        TracePrintf(0, "InitSwap: couldn't create swap file '%s', running without swap.\n", SWAP_FILE_NAME);
+        free(swap_slot_refcount);
+        swap_slot_refcount = NULL;
+        return;
+    }
+
+    TracePrintf(0, "InitSwap: swap file '%s' has (%d) slots.\n", SWAP_FILE_NAME, SWAP_SLOTS);
+}
+
+/*
+ * Takes a free slot of the swap file, searching on from the slot after the
+ * last one taken so that pages written out together land next to each other.
+ * Returns the slot number, or -1 if the swap file is full.
+ */
+long AllocateSwapSlot() {
+    int n;
+    for (n = 0; n < SWAP_SLOTS; n++) {
+        int slot = swap_slot_hint;
+        swap_slot_hint = (swap_slot_hint + 1) % SWAP_SLOTS;
+
+        if (swap_slot_refcount[slot] == 0) {
+            swap_slot_refcount[slot] = 1;
+            swap_slots_used++;
+            return slot;
+        }
+    }
+
+    return (-1);
+}
+
+/*
+ * Adds a reference to a swap slot that another page table entry now refers
+ * to as well, e.g. the child's copy of a swapped-out page after Fork.
+ */
+void ShareSwapSlot(unsigned int slot) {
+    swap_slot_refcount[slot]++;
+}
+
+/*
+ * Drops one reference to a swap slot; the last one frees it.
+ */
+void FreeSwapSlot(unsigned int slot) {
+    if (--swap_slot_refcount[slot] == 0) {
+        swap_slots_used--;
+    }
+}
+
+/*
+ * Writes up to SWAP_BATCH cold user pages to the swap file and frees their
+ * frames. A clock hand moves over the region 0 page tables of every process.
+ * The hardware keeps no referenced bit, so the hand makes a resident private
+ * page invalid and tags it PTE_UNREF; if the process touches the page again,
+ * FaultInPage simply makes it valid again. A page still PTE_UNREF when the
+ * hand comes back has not been used for a whole sweep and is written out.
+ * Shared frames (text, pages shared since Fork, the zero frame) and kernel
+ * stacks are never taken, and neither are the current process's pages: the
+ * kernel may be part way through checking a user buffer of it with
+ * PrepareUserAccess, and taking a page it has already checked would make the
+ * copy that follows fault in kernel mode. Pages of long-blocked processes
+ * are compressed in memory instead if they can be (see zram.c). Returns the
+ * number of frames freed, 0 if no other process has a page to give up, so
+ * the allocation that needed the frame fails cleanly.
+ */
+int ReclaimFrames() {
+    PCB *victim_pcb[SWAP_BATCH];
+    unsigned long victim_vpn[SWAP_BATCH];
+    int nvictims = 0;
+    int sweeps = 0;
+
+    // Pages of processes blocked a long time go to the compressed store first, which needs no file I/O.
+    int freed = ZramCompressIdle();
+    if (freed > 0 || swap_fd < 0) {
+        return freed;
+    }
+
+    // A page is marked on one full sweep and taken on the next; the first sweep may start part way through.
+    while (nvictims < SWAP_BATCH && sweeps < 3) {
+        PCB *pcb = proc_table[swap_hand_slot];
+
+        // Move the hand on to the next process at the end of this one's pages in use.
+        if (pcb == NULL || pcb == idle_pcb || pcb == curr_proc || pcb->state == PROC_TERMINATED
+            || (swap_hand_vpn = NextUsedPage(pcb, swap_hand_vpn)) >= USER_PAGES) {
+            swap_hand_slot = (swap_hand_slot + 1) % PROC_TABLE_SIZE;
+            swap_hand_vpn = MEM_INVALID_PAGES;
+            if (swap_hand_slot == 0) {
+                sweeps++;
+            }
+            continue;
+        }
+
+        struct pte *pte = &pcb->pgt_r0[swap_hand_vpn];
+
+        if (pte->valid == 1 && (long) pte->pfn != zero_pfn && frame_refcount[pte->pfn] == 1) {
+            // Clear the page's emulated referenced bit. The process is not running, so it has no TLB entry to flush.
+            pte->valid = 0;
+            pte->unused |= PTE_UNREF;
+        } else if (pte->valid == 0 && (pte->unused & PTE_UNREF)) {
+            victim_pcb[nvictims] = pcb;
+            victim_vpn[nvictims] = swap_hand_vpn;
+            nvictims++;
+        }
+
+        swap_hand_vpn++;
+    }
+
+    // Write the batch out. Slots are mostly consecutive, so the file offset usually needs no seek.
+    int i;
+    long next_slot = -1; // Slot the swap file's offset is at, -1 if unknown
+    for (i = 0; i < nvictims; i++) {
+        struct pte *pte = &victim_pcb[i]->pgt_r0[victim_vpn[i]];
+
+        long slot = AllocateSwapSlot();
+        if (slot < 0) {
+            TracePrintf(0, "ReclaimFrames: swap file is full.\n");
+            break;
+        }
+
+        char *frame = (char *) KMap(pte->pfn);
+        int written = (slot == next_slot || lseek(swap_fd, slot << PAGESHIFT, SEEK_SET) >= 0)
+            && write(swap_fd, frame, PAGESIZE) == PAGESIZE;
+        KUnmap(frame);
+
+        if (!written) {
+            // The page stays resident; the next touch makes it valid again.
+            TracePrintf(0, "ReclaimFrames: couldn't write swap slot (%d).\n", slot);
+            FreeSwapSlot((unsigned int) slot);
+            next_slot = -1;
+            continue;
+        }
+
+        FreePhysicalPage(pte->pfn);
+        pte->pfn = (unsigned int) slot;
+        pte->unused = (pte->unused & ~PTE_UNREF) | PTE_SWAP;
+        victim_pcb[i]->resident_pages--;
+
+        next_slot = slot + 1;
+        freed++;
+        swap_outs++;
+    }
+
+    TracePrintf(0, "ReclaimFrames: wrote out (%d) pages, (%d) frames free.\n", freed, free_pframe_count);
+
+    return freed;
+}
+
+/*
+ * Swaps out cold pages until at least n frames are free. Returns 0 if they
+ * are, ERROR if nothing more can be swapped out.
+ */
+int EnsureFreeFrames(int n) {
+    while (free_pframe_count < n) {
+        if (ReclaimFrames() == 0) {
+            return ERROR;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads region 0 page vpn of the current process, tagged PTE_SWAP, back
+ * from the swap file into a new frame and makes it valid with the
+ * protections it had, adding the time it takes to the fault latency
+ * counters. Returns 0 on success, ERROR if there is no frame for it or the
+ * swap file cannot be read.
+ */
+int SwapInPage(unsigned long vpn) {
+    struct pte *pte = &curr_proc->pgt_r0[vpn];
+    unsigned int slot = pte->pfn;
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+
+    long pfn;
+    if ((pfn = AllocateFreePage()) < 0) {
+        TracePrintf(0, "SwapInPage: no free frame for page (%d).\n", vpn);
+        return ERROR;
+    }
+
+    char *frame = (char *) KMap((unsigned long) pfn);
+    if (lseek(swap_fd, (long) slot << PAGESHIFT, SEEK_SET) < 0 || read(swap_fd, frame, PAGESIZE) != PAGESIZE) {
+        TracePrintf(0, "SwapInPage: couldn't read swap slot (%d).\n", slot);
+        KUnmap(frame);
+        FreePhysicalPage((unsigned int) pfn);
+        return ERROR;
+    }
+    KUnmap(frame);
+
+    // Another process may still refer to the slot since Fork; it reads its own copy.
+    FreeSwapSlot(slot);
+
+    pte->pfn = (unsigned int) pfn;
+    pte->unused &= ~PTE_SWAP;
+    pte->valid = 1;
+    curr_proc->resident_pages++;
+
+    TLBFlushAddress(vpn << PAGESHIFT);
+
+    gettimeofday(&end, NULL);
+    swap_ins++;
+    swap_in_usec += (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+
+    TracePrintf(0, "SwapInPage: read slot (%d) into pfn (%d) at page (%d) for process (%d).\n", slot, pfn, vpn, curr_proc->pid);
+
+    return 0;
+}
+
+/*
+ * Frees whatever user page vpn of pcb holds: its frame if it is valid or
+ * only invalidated by the swap clock, or its swap slot or compressed copy if
+ * it is swapped out or compressed. The pte is left invalid with no tags and
+ * unmarked in the page map. The caller flushes the TLB if the pte was valid.
+ */
+void ReleaseUserPage(PCB *pcb, unsigned long vpn) {
+    struct pte *pte = &pcb->pgt_r0[vpn];
+
+    if (pte->valid == 1 || (pte->unused & PTE_UNREF)) {
+        if ((long) pte->pfn != zero_pfn) {
+            pcb->resident_pages--;
+        }
+        FreePhysicalPage(pte->pfn);
+    } else if (pte->unused & PTE_SWAP) {
+        FreeSwapSlot(pte->pfn);
+    } else if (pte->unused & PTE_ZRAM) {
+        FreeZramEntry(pte->pfn);
+    }
+
+    pte->valid = 0;
+    pte->unused = 0;
+    MarkPageUnused(pcb, vpn);
+}
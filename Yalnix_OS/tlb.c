@@ -0,0 +1,108 @@
+#include "function.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include </clear/courses/comp421/pub/include/comp421/yalnix.h>
+#include </clear/courses/comp421/pub/include/comp421/hardware.h>
+#include </clear/courses/comp421/pub/include/comp421/loadinfo.h>
+
+/*
+ * Records that the TLB entry for the page holding addr (in region 0 or 1) is
+ * stale. Nothing is written to the hardware until TLBFlushPending, so the
+ * caller must call it before anything touches the page again. Once more than
+ * TLB_BATCH_LIMIT pages of a region are pending, the whole region is flushed
+ * instead.
+ */
+void TLBInvalidate(unsigned long addr) {
+    int region = (addr >= VMEM_1_BASE) ? 1 : 0;
+    unsigned long page = DOWN_TO_PAGE(addr);
+
+    tlb_pages_invalidated++;
+
+    if (tlb_pending_all[region]) {
+        tlb_flushes_avoided++;
+        return;
+    }
+
+    // A page already pending needs no second flush.
+    int i;
+    for (i = 0; i < tlb_pending_count[region]; i++) {
+        if (tlb_pending[region][i] == page) {
+            tlb_flushes_avoided++;
+            return;
+        }
+    }
+
+    if (tlb_pending_count[region] == TLB_BATCH_LIMIT) {
+        // One region flush now replaces every pending address and this one.
+        tlb_flushes_avoided += tlb_pending_count[region];
+        tlb_pending_all[region] = 1;
+        tlb_pending_count[region] = 0;
+        return;
+    }
+
+    tlb_pending[region][tlb_pending_count[region]++] = page;
+}
+
+/*
+ * Records that every TLB entry of a region (0 or 1) is stale, e.g. after the
+ * region's page table is replaced. Pending addresses in it are dropped.
+ */
+void TLBInvalidateRegion(int region) {
+    tlb_flushes_avoided += tlb_pending_count[region];
+    tlb_pending_count[region] = 0;
+    tlb_pending_all[region] = 1;
+}
+
+/*
+ * Issues the hardware flushes for everything recorded since the last call:
+ * one TLB_FLUSH_0, TLB_FLUSH_1 or TLB_FLUSH_ALL for regions marked whole,
+ * and one flush per address otherwise.
+ */
+void TLBFlushPending() {
+    if (tlb_pending_all[0] && tlb_pending_all[1]) {
+        WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_ALL);
+        tlb_region_flushes++;
+        tlb_flushes_avoided++;
+    } else {
+        int region;
+        for (region = 0; region < 2; region++) {
+            if (tlb_pending_all[region]) {
+                WriteRegister(REG_TLB_FLUSH, (region == 0) ? TLB_FLUSH_0 : TLB_FLUSH_1);
+                tlb_region_flushes++;
+                continue;
+            }
+
+            int i;
+            for (i = 0; i < tlb_pending_count[region]; i++) {
+                WriteRegister(REG_TLB_FLUSH, (RCS421RegVal) tlb_pending[region][i]);
+                tlb_address_flushes++;
+            }
+        }
+    }
+
+    tlb_pending_count[0] = tlb_pending_count[1] = 0;
+    tlb_pending_all[0] = tlb_pending_all[1] = 0;
+}
+
+/*
+ * Flushes the TLB entry for the page holding addr right away, along with
+ * anything else pending. For single page changes that are used at once.
+ */
+void TLBFlushAddress(unsigned long addr) {
+    TLBInvalidate(addr);
+    TLBFlushPending();
+}
+
+/*
+ * Flushes a whole region (0 or 1) right away, along with anything else
+ * pending. Used when REG_PTR0 changes.
+ */
+void TLBFlushRegion(int region) {
+    TLBInvalidateRegion(region);
+    TLBFlushPending();
+}
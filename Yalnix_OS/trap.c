@@ -12,7 +12,7 @@
 
 /*
  * Manages clock interrupts to update process times, handle delayed processes,
- * and potentially trigger context switches for round-robin scheduling.
+ * and potentially trigger context switches for multi-level feedback queue scheduling.
  */
 void TrapClockHandler(ExceptionInfo *info) {
     // This handler is invoked on every clock interrupt.
@@ -22,54 +22,51 @@ void TrapClockHandler(ExceptionInfo *info) {
     curr_proc->runningTime += 1;
     total_runningTime++;
 
-    /* First check delay queue to see if there is any process to switch to. */
-    if (IsLinkedListEmpty(delay_queue) != 1) {
-        TracePrintf(0, "TrapClockHandler: looking through elements in delay queue.\n");
-        ListNode* temp = delay_queue->head;
-        ListNode* temp2;
-        PCB* toRemove;
-        while (temp != NULL) {
-            TracePrintf(0, "TrapClockHandler: looking at PCB pid (%d) with delay (%d).\n", 
-            ((PCB*) temp->data)->pid, ((PCB*) temp->data)->delay_until);
-
-            if (total_runningTime > ((PCB*) temp->data)->delay_until) {
-                // If delay is over for one of the processes, then remove it from delay queue.
-                temp2 = temp->next;
-                toRemove = SearchAndReturnPCB(delay_queue, ((PCB*) temp->data)->pid);
-                SearchAndRemovePCB(delay_queue, ((PCB*) temp->data)->pid);
-
-                // Add it to the ready/running queue.
-                enqueueToList(runningQueue, toRemove);
-
-                TracePrintf(0, "TrapClockHandler: removed process (%d) from delay queue and added to ready queue.\n", toRemove->pid);
-
-                // Now reset the temp pointer.
-                temp = temp2;
-            } else {
-                temp = temp->next;
-            }
-        }
+    /* First wake every delayed process whose deadline has passed. The heap keeps the earliest deadline on top, so only expired entries are touched. */
+    PCB *delayed;
+    while ((delayed = DelayHeapPeek()) != NULL && total_runningTime > delayed->delay_until) {
+        DelayHeapPop();
+
+        // Add it to the ready queue.
+        MakeProcessReady(delayed);
+
+        TracePrintf(0, "TrapClockHandler: removed process (%d) from delay heap and added to ready queue.\n", delayed->pid);
     }
 
+    /* Periodically move every ready process back to the top level so none starve. */
+    if (total_runningTime % PRIORITY_BOOST_INTERVAL == 0) {
+        BoostAllReady();
+        if (curr_proc != idle_pcb) {
+            curr_proc->priority = 0;
+        }
+    }
 
-    /* Check if the current process has exhausted its time period. */
-    if (curr_proc->runningTime >= 2) { 
-        // Reset the running time for the current process.
+    /* Decide whether the current process should give up the CPU. */
+    if (curr_proc == idle_pcb) {
+        // Idle only runs while nothing else is ready, so switch as soon as something is.
+        if (HighestReadyPriority() < NUM_PRIORITY_LEVELS) {
+            scheduleNextProcess();
+        }
+    } else if (curr_proc->runningTime >= level_quantum[curr_proc->priority]) {
+        // The process used its whole time slice, so it is CPU-bound: demote it.
+        DemotePriority(curr_proc);
         curr_proc->runningTime = 0;
 
-        // Perform a context switch to the next process in the round-robin manner.
-        // Schedule next process to run 
-        if (!(IsLinkedListEmpty(runningQueue))) {
-            PCB *pcb_2 = dequeueFromList(runningQueue);
-
-            // Do not enqueue idle process to runningQueue
-            if (curr_proc != idle_pcb){
-                enqueueToList(runningQueue, curr_proc);
-            }
-            
-            ContextSwitch(MySwitchFunc, curr_proc->ctx, curr_proc, pcb_2);
-        } 
-        // If no ready process, continue executing the current process for two more clock tick
+        // Round-robin with anything at the same or a higher level; otherwise keep running with a fresh slice.
+        if (HighestReadyPriority() <= curr_proc->priority) {
+            MakeProcessReady(curr_proc);
+            scheduleNextProcess();
+        }
+    } else if (HighestReadyPriority() < curr_proc->priority) {
+        // A higher priority process became ready (e.g. woke up from a Delay), so preempt without demoting.
+        MakeProcessReady(curr_proc);
+        scheduleNextProcess();
+    }
+
+    /* Spend ticks with nothing else to run zeroing free frames ahead of time and merging identical pages. */
+    if (curr_proc == idle_pcb) {
+        RefillZeroPool();
+        KsmScan();
     }
 
     (void) info; // Prevent compilation errors.
@@ -157,8 +154,8 @@ void TerminateProcess(PCB *pcb, int exit_status){
     // Notify all children that they are now orphan
     notifyChildren(pcb);
 
-    // Set the flag indicating that we should delete this process when doing ContextSwitch
-    pcb->isTerminated = 1;
+    // Set the state indicating that we should delete this process when doing ContextSwitch
+    pcb->state = PROC_TERMINATED;
 
     // Perform a context switch to the next process (and also terminate current running process)
     scheduleNextProcess();
@@ -170,19 +167,17 @@ void TerminateProcess(PCB *pcb, int exit_status){
 void notifyParent(int parent_pid, PCB *child_pcb, int exit_status){
 
     // Get the PCB for parent process
-    PCB* parent_pcb = child_pcb->parent;
+    PCB* parent_pcb = FindProcess(parent_pid);
 
     // If the exiting process does not have a parent (i.e. idle process or terminated parent), we can skip these steps.
     if (parent_pcb != NULL) {
         // Remove this exited child from parent's running_children list
-        if (SearchAndRemovePCB(parent_pcb->running_children, child_pcb->pid) == ERROR){
-            perror("Error in removing child's PCB from parent's running_children list");
-        }
+        removeRunningChild(parent_pcb, child_pcb);
 
         // If parent was waiting to collect a child, we remove it from wait queue and add it to ready queue.
-        if (SearchAndRemovePCB(wait_queue, parent_pid) == 1){
-            // If parent found in wait queue, now add it to ready queue.
-            enqueueToList(runningQueue, parent_pcb);
+        if (parent_pcb->state == PROC_WAITING) {
+            removePCB(parent_pcb);
+            MakeProcessReady(parent_pcb);
         }
 
         // Push children exit status to exited_children list for parent's reference
@@ -204,16 +199,17 @@ void notifyChildren(PCB *pcb){
         perror("pcb is null at notifyChildren"); 
     }
 
-    ListNode* current = pcb->running_children->head; // Start at the head of the children list
+    PCB* child_pcb = pcb->running_children.head; // Start at the head of the children list
 
-    while (current != NULL) {
-        PCB* child_pcb = (PCB*)current->data; // Cast the data to a PCB pointer
-        if (child_pcb != NULL) {
-            child_pcb->parent_pid = -1; // Indicate that the child is orphan
-            child_pcb->parent = NULL;
-        }
-        current = current->next; // Move to the next child in the list
+    while (child_pcb != NULL) {
+        PCB* next_child = child_pcb->sibling_next;
+        child_pcb->parent_pid = -1; // Indicate that the child is orphan
+        child_pcb->sibling_next = NULL;
+        child_pcb->sibling_prev = NULL;
+        child_pcb = next_child; // Move to the next child in the list
     }
+    pcb->running_children.head = NULL;
+    pcb->running_children.tail = NULL;
 }
 
 
@@ -221,9 +217,9 @@ void notifyChildren(PCB *pcb){
  * Helper function to schedule next runnable process 
  */
 void scheduleNextProcess(){
-    // Schedule next process to run 
-    if (!(IsLinkedListEmpty(runningQueue))) {
-        PCB *pcb_2 = dequeueFromList(runningQueue);
+    // Schedule next process to run, taken from the highest non-empty MLFQ level
+    PCB *pcb_2 = PickNextReady();
+    if (pcb_2 != NULL) {
         ContextSwitch(MySwitchFunc, curr_proc->ctx, curr_proc, pcb_2);
     } else {
         TracePrintf(0, "scheduleNextProcess: switching from  (%d) to idle.\n", curr_proc->pid);
@@ -248,6 +244,33 @@ void TrapMemoryHandler(ExceptionInfo *info){
 
     TracePrintf(0, "TrapMemoryHandler: faultingPageIndex (%d)\n", faultingPageIndex);
 
+    // A write to a page shared copy-on-write since Fork: give this process its own copy and retry.
+    if (faultingPageIndex < PAGE_TABLE_LEN
+        && curr_proc->pgt_r0[faultingPageIndex].valid == 1
+        && (curr_proc->pgt_r0[faultingPageIndex].unused & PTE_COW)) {
+        if (BreakCopyOnWrite(faultingPageIndex) == ERROR) {
+            fprintf(stderr, "Error: Process %d has no memory left to copy page at 0x%lx; terminating process.\n",
+            curr_proc->pid, (unsigned long)info->addr);
+            TerminateProcess(curr_proc, ERROR);
+        }
+        return;
+    }
+
+    // First touch of a text, data, bss or heap page that is not loaded yet, or of any page the swap clock
+    // invalidated, wrote out or compressed: bring it in and retry.
+    if (faultingPageIndex < PAGE_TABLE_LEN
+        && curr_proc->pgt_r0[faultingPageIndex].valid == 0
+        && ((curr_proc->pgt_r0[faultingPageIndex].unused & (PTE_UNREF | PTE_SWAP | PTE_ZRAM))
+            || (faultingPageIndex >= MEM_INVALID_PAGES
+                && faultingPageIndex < (UP_TO_PAGE(curr_proc->brk) >> PAGESHIFT)))) {
+        if (FaultInPage(faultingPageIndex) == ERROR) {
+            fprintf(stderr, "Error: Process %d could not bring in page at 0x%lx; terminating process.\n",
+            curr_proc->pid, (unsigned long)info->addr);
+            TerminateProcess(curr_proc, ERROR);
+        }
+        return;
+    }
+
     // Calculate the number of page demanded
     unsigned int num_page_demanded = curr_proc->uStack_bottom - faultingPageIndex;
     
@@ -255,40 +278,32 @@ void TrapMemoryHandler(ExceptionInfo *info){
     /* Check if 
             1. faulting address is below uStack bottom and above uheap top,  
                + 1 make sure that we leave one free page between uheap and uStack
-            2. make sure we have enough physcial memory to allocate 
+       New stack pages map the zero frame, so no physical memory is needed until they are written.
     */
     if (faultingPageIndex > (UP_TO_PAGE(curr_proc->brk) >> PAGESHIFT) + 1 
-        && faultingPageIndex < curr_proc->uStack_bottom
-        && num_page_demanded <= (unsigned long) free_pframe_count){
+        && faultingPageIndex < curr_proc->uStack_bottom){
 
-        unsigned int i = 0;
         unsigned int ptr_bottom = curr_proc->uStack_bottom;
 
-        while (i < num_page_demanded){
-            // Move stack bottom up one page.
+        while (ptr_bottom > faultingPageIndex){
+            // Move stack bottom down one page.
             ptr_bottom--;
 
             if (curr_proc->pgt_r0[ptr_bottom].valid == 0) {
-                // Allocate a new page to extend the stack.
-                long newFrame;
-                if ((newFrame = AllocateFreePage()) == -1) {
-                    perror("No more free Physical memory at TrapMemoryHandler()");
-                    return;
-                }
-                // Update the page table entry for the new stack page.
-                curr_proc->pgt_r0[ptr_bottom].valid = 1;
-                curr_proc->pgt_r0[ptr_bottom].pfn = (unsigned int)newFrame;
-                curr_proc->pgt_r0[ptr_bottom].uprot = PROT_READ | PROT_WRITE; 
-                curr_proc->pgt_r0[ptr_bottom].kprot = PROT_READ | PROT_WRITE;
-
-                num_page_demanded--;
+                // Extend the stack with a zero page; a write fault then gives it a private frame.
+                MapZeroPage(ptr_bottom);
+                TLBInvalidate((unsigned long) ptr_bottom << PAGESHIFT);
             } else {
                 perror("Trying to allocate free PTE but it is mapped at TrapMemoryHandler()");
+                TLBFlushPending();
                 return;
             }   
         }
         // Set location of new user stack bottom.
         curr_proc->uStack_bottom = faultingPageIndex;
+
+        // Flush the TLB entries for the new stack pages.
+        TLBFlushPending();
     } else {
         // The faulting address is not within the stack's auto-extension range.
         // This is an illegal memory access, so terminate the process.
@@ -332,43 +347,70 @@ void TrapReceiveHandler(ExceptionInfo *info){
     int tty_id = info->code; 
     TracePrintf(0, "Retrieve Terminal ID: (%d).\n", tty_id);
 
-    // Allocate a new textStruct for the line of text
-    textStruct* newText = malloc(sizeof(textStruct));  
+    TtyInput *in = &inputRing[tty_id];
 
-    // Initialize ptr to 0
-    newText->ptr = 0;
+    // Receive straight into the ring when a whole line fits there without wrapping; otherwise receive into
+    // the terminal's spare line and copy it in if there is room.
+    int tail = (in->head + in->count) % TTY_IN_RING_SIZE;
+    int direct = (TTY_IN_RING_SIZE - in->count >= TERMINAL_MAX_LINE && TTY_IN_RING_SIZE - tail >= TERMINAL_MAX_LINE
+                  && in->lines < TTY_IN_MAX_LINES);
+    int n = TtyReceive(tty_id, direct ? in->ring + tail : in->rx, TERMINAL_MAX_LINE);
 
-    // Perform the receive operation for the terminal
-    newText->length = TtyReceive(tty_id, newText->line, TERMINAL_MAX_LINE);
+    if (!direct) {
+        if (TtyInputMakeRoom(in, n) == ERROR) {
+            TracePrintf(0, "TrapReceiveHandler: input ring of terminal (%d) full, dropping (%d) bytes.\n", tty_id, n);
+            in->dropped_lines++;
+            in->dropped_bytes += n;
+            return;
+        }
 
-    enqueueToList(inputBuffer[tty_id], newText);
+        // The oldest lines may have been dropped to make room, so find the end of the ring again.
+        tail = (in->head + in->count) % TTY_IN_RING_SIZE;
+        int first = (n < TTY_IN_RING_SIZE - tail) ? n : TTY_IN_RING_SIZE - tail;
+        memcpy(in->ring + tail, in->rx, first);
+        memcpy(in->ring, in->rx + first, n - first);
+    }
 
-    // Set the flag indicating that terminal tty_id is ready to read
-    readReady[tty_id] = 1;
+    in->count += n;
+    in->line_len[(in->line_head + in->lines) % TTY_IN_MAX_LINES] = n;
+    in->lines++;
 
-    // while there are some processes waiting on TtyRead, and there
-    // are available text to read, unblock it to read the Terminal
-    int i = 0;
-    while (!IsLinkedListEmpty(readQueue[tty_id]) && readReady[tty_id] == 1){
-        PCB *pcb2;
-        if ((pcb2 = dequeueFromList(readQueue[tty_id])) == NULL){
-            fprintf(stderr, "readQueue should not return null at TrapReceiveHandler()\n");
-            return;
-        }
-        enqueueToList(runningQueue, curr_proc);
-        ContextSwitch(MySwitchFunc, curr_proc->ctx, curr_proc, pcb2);
+    // Make a waiting reader ready for each line no reader has been woken for yet, and leave it to the scheduler to
+    // run them, so a burst of input does not switch away from the interrupted process once per line.
+    WakeTtyReaders(tty_id);
 
-        // Below should be redundant since we set this when at TtyRead
-        if (IsLinkedListEmpty(inputBuffer[tty_id])){
-            // All text has been read, reset the read-ready flag
-            readReady[tty_id] = -1;
-        }
-        TracePrintf(0, "Iteration: (%d).\n", i++);
+    // Idle has nothing to lose, so give the CPU up at once.
+    if (curr_proc == idle_pcb && HighestReadyPriority() < NUM_PRIORITY_LEVELS) {
+        scheduleNextProcess();
     }
 
     return;
 }
 
+/*
+ * Makes room in a terminal's input ring for a new line of n bytes, by the
+ * TTY_IN_OVERFLOW policy: with TTY_IN_DROP_OLDEST the oldest lines are
+ * thrown away (and counted) until it fits. Returns 0 if the line fits now,
+ * ERROR if it is to be dropped.
+ */
+int TtyInputMakeRoom(TtyInput *in, int n) {
+    while (TTY_IN_OVERFLOW == TTY_IN_DROP_OLDEST && in->lines > 0
+           && (TTY_IN_RING_SIZE - in->count < n || in->lines == TTY_IN_MAX_LINES)) {
+        int oldest = in->line_len[in->line_head];
+        in->head = (in->head + oldest) % TTY_IN_RING_SIZE;
+        in->count -= oldest;
+        in->line_head = (in->line_head + 1) % TTY_IN_MAX_LINES;
+        in->lines--;
+        in->dropped_lines++;
+        in->dropped_bytes += oldest;
+    }
+
+    if (TTY_IN_RING_SIZE - in->count < n || in->lines == TTY_IN_MAX_LINES) {
+        return ERROR;
+    }
+    return 0;
+}
+
 /* Manages terminal output completion. */
 void TrapTransmitHandler(ExceptionInfo *info){
     TracePrintf(0, "TrapTransmitHandler: entered by process (%d).\n", curr_proc->pid);
@@ -381,35 +423,19 @@ void TrapTransmitHandler(ExceptionInfo *info){
     // Retrieve the terminal ID from the ExceptionInfo
     int tty_id = info->code;
 
-    // Find the PCB that called the TtyTransmit, which caused this interrupt.
-    PCB *pcb2;
-    pcb2 = transmitPCB[tty_id];
-    
     // Since TtyTransmit successfully done, we set that write is again possible.
     writeReady[tty_id] = 1;
 
-    // Switch to the process that initiate this TtyWrite
-    enqueueToList(runningQueue, curr_proc);
-    ContextSwitch(MySwitchFunc, curr_proc->ctx, curr_proc, pcb2);
-
-    // If there are more processes waiting to execute TtyWrite, 
-    // unblock one by calling TtyTransmit - if write is ready.
-    if (!IsLinkedListEmpty(writeQueue[tty_id]) && writeReady[tty_id] == 1) {
+    // Keep the terminal busy: send whatever has gathered in its output ring since (several writes merged into
+    // one transmit). Writers blocked on a full ring are made ready once it drains.
+    StartTtyTransmit(tty_id);
 
-        // Otherwise, we can ttytransmit now.
-        PCB *blocked_pcb;
-        if ((blocked_pcb = peekFromList(writeQueue[tty_id])) == NULL) {
-            fprintf(stderr, "writeQueue should not be empty given that IsLinkedListEmpty returns false at TrapTransmitHandler()\n");
-            return;
-        }
+    // If every process has exited, this may have been the last output the kernel was waiting on before halting.
+    HaltIfFinished();
 
-        TracePrintf(0, "TrapTransmitHandler: switching back to write for process (%d)\n", blocked_pcb->pid);
-        
-        // Dequeue the blocked process and add it to ready/running queue.
-        dequeueFromList(writeQueue[tty_id]);
-        writeReady[tty_id] = -1; 
-        transmitPCB[tty_id] = blocked_pcb;
-        TtyTransmit(tty_id, blocked_pcb->writeRequest, blocked_pcb->writeLength);
+    // Idle has nothing to lose, so give the CPU up at once.
+    if (curr_proc == idle_pcb && HighestReadyPriority() < NUM_PRIORITY_LEVELS) {
+        scheduleNextProcess();
     }
 
     return;
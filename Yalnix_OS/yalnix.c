@@ -13,14 +13,20 @@
 
 /* ######################## Global Variable ######################## */
 
-unsigned int pid_counter = 0; // Global counter used to assign unique process IDs (PID)
 PCB* curr_proc = NULL;  // Points to the current runnning process
-int is_half_used = 0; // Flag variable to indicate if region 1 page table page is half used
 
-LinkedList* processQueue = NULL; // List of all processes 
-LinkedList* runningQueue = NULL; // FIFO queue for all ready-running processes
-LinkedList* delay_queue = NULL; // FIFO queue for all delayed processes
-LinkedList* wait_queue = NULL; // FIFO queue for all waiting processes
+PCB* proc_table[PROC_TABLE_SIZE] = {NULL}; // Live processes indexed by pid % PROC_TABLE_SIZE
+unsigned int proc_generation[PROC_TABLE_SIZE] = {0}; // Times each slot has been reused, the high part of the slot's next pid
+int proc_free_slots[PROC_TABLE_SIZE]; // FIFO ring of free slot indices, so a freed pid is reused as late as possible
+int proc_free_head = 0; // Index in proc_free_slots of the next slot to hand out
+int proc_free_count = 0; // Number of free slots in proc_free_slots
+int proc_table_count = 0; // Number of live processes in proc_table, including idle
+PCBQueue readyQueue[NUM_PRIORITY_LEVELS]; // FIFO queue of ready processes for each MLFQ level
+unsigned int ready_bitmap = 0; // Bit i is set if readyQueue[i] is non-empty
+PCB** delay_heap = NULL; // Min-heap of delayed processes keyed on delay_until
+int delay_heap_size = 0; // Number of processes in delay_heap
+int delay_heap_capacity = 0; // Number of slots allocated for delay_heap
+PCBQueue wait_queue; // FIFO queue for all waiting processes
 
 
 InterruptHandler *interruptVectorTable = NULL;
@@ -30,8 +36,16 @@ int vm_enabled = 0; // Flag to indicate if VM is enabled
 // Page Tables
 struct pte *pgt_r0 = NULL;
 struct pte *pgt_r1 = NULL;
-unsigned long addr_next_pgt_r0 = VMEM_1_LIMIT - PAGESIZE;
-unsigned long curr_pgt_paddr = 0;
+unsigned long addr_next_pgt_r0 = KMAP_BASE - PAGESIZE; // Page tables grow down from just below the kernel mapping slots
+ProgramImage *image_registry = NULL; // Program images in use, one per program file
+ImageCacheEntry *image_cache_head = NULL; // Most recently used image cache entry
+ImageCacheEntry *image_cache_tail = NULL; // Least recently used image cache entry
+int image_cache_count = 0; // Number of entries in the image cache
+unsigned long image_cache_bytes = 0; // Text and data bytes held by the image cache
+unsigned long image_cache_hits = 0; // Execs that found their program in the image cache
+unsigned long image_cache_misses = 0; // Execs that had to open their program file
+PageTableSlot *pgt_free_head = NULL; // Free half-page slots in mapped page table pages
+unsigned long pgt_hole_head = 0; // Unmapped pages in the page table area, chained through their region 1 ptes' pfn fields
 
 // Idle process's PCB
 PCB* idle_pcb = NULL;
@@ -39,17 +53,69 @@ PCB* idle_pcb = NULL;
 // Total program running time.
 unsigned long total_runningTime = 0;
 
-// Physical frame head, and count.
-pframe *free_pframe_head = NULL;
+// Physical frame allocator: a list of freed frames, then frames never handed out yet, and the free count.
+long free_pframe_head = NO_FRAME; // Frame number of the first frame on the free list, NO_FRAME if empty
+unsigned long next_untouched_pfn = 0; // Lowest frame number never handed out; every frame from here up is free
+unsigned long num_pframes = 0; // Number of physical frames
+unsigned long kernel_reserved_lo = 0; // First frame of the kernel stack and region 1 kernel image, never handed out
+unsigned long kernel_reserved_hi = 0; // First frame above the kernel's reserved frames
+long kmap_pfn[KMAP_SLOTS]; // Frame mapped in each kernel mapping slot, NO_FRAME if none
+int kmap_pins[KMAP_SLOTS] = {0}; // Number of KMap callers using each slot; a pinned slot is never remapped
+unsigned long kmap_last_use[KMAP_SLOTS] = {0}; // Value of kmap_clock when each slot was last handed out
+unsigned long kmap_clock = 0; // Count of KMap calls, to find the least recently used slot
+unsigned long kmap_hits = 0; // KMap calls that found the frame already mapped
+unsigned long kmap_misses = 0; // KMap calls that had to remap a slot
 int free_pframe_count = 0;
+unsigned int *frame_refcount = NULL; // Number of page table entries mapping each allocated frame
+unsigned long tlb_pending[2][TLB_BATCH_LIMIT]; // Stale pages of region 0 and 1 not flushed yet
+int tlb_pending_count[2] = {0, 0}; // Number of pages in tlb_pending for each region
+int tlb_pending_all[2] = {0, 0}; // Set if the whole region needs flushing
+unsigned long tlb_pages_invalidated = 0; // Pages recorded as stale
+unsigned long tlb_address_flushes = 0; // Single-address flushes written to the hardware
+unsigned long tlb_region_flushes = 0; // Whole-region (or whole-TLB) flushes written to the hardware
+unsigned long tlb_flushes_avoided = 0; // Recorded invalidations that needed no flush of their own
+long zero_pfn = NO_FRAME; // Frame of zeros shared by every untouched zero page; not reference counted, never freed
+long zero_pool[ZERO_POOL_SIZE]; // Free frames already zeroed; counted in free_pframe_count, but not on the free list
+int zero_pool_count = 0; // Number of frames in zero_pool
+unsigned long zero_pool_hits = 0; // Zeroed frames handed out from the pool
+unsigned long zero_pool_misses = 0; // Zeroed frames that had to be zeroed when allocated
+int swap_fd = -1; // Open swap file, -1 if running without swap
+unsigned short *swap_slot_refcount = NULL; // Number of page table entries referring to each swap slot
+int swap_slots_used = 0; // Number of swap slots in use
+int swap_slot_hint = 0; // Slot AllocateSwapSlot looks at first
+int swap_hand_slot = 0; // Process table slot the swap clock hand is at
+unsigned long swap_hand_vpn = MEM_INVALID_PAGES; // Region 0 page the swap clock hand is at
+unsigned long swap_outs = 0; // Pages written to the swap file
+unsigned long swap_ins = 0; // Pages read back from the swap file
+unsigned long swap_rescues = 0; // Pages the swap clock checked that were used again before being written out
+unsigned long swap_in_usec = 0; // Microseconds spent reading pages back from the swap file
+ZramEntry zram_entries[ZRAM_MAX_ENTRIES]; // Compressed pages
+ZramFrame zram_pool[ZRAM_POOL_FRAMES]; // Frames holding the compressed pages
+int zram_pool_count = 0; // Number of frames in zram_pool
+int zram_stored_pages = 0; // Number of pages held compressed
+unsigned long zram_stored_bytes = 0; // Compressed bytes of the pages held
+unsigned long zram_stores = 0; // Pages compressed
+unsigned long zram_rejected = 0; // Pages that did not compress well enough to keep
+unsigned long zram_loads = 0; // Pages decompressed on a fault
+unsigned long zram_load_usec = 0; // Microseconds spent decompressing pages on faults
+KsmEntry ksm_table[KSM_TABLE_SIZE]; // Recorded pages by hash, for the merging scanner
+int ksm_hand_slot = 0; // Process table slot the merging scanner is at
+unsigned long ksm_hand_vpn = MEM_INVALID_PAGES; // Region 0 page the merging scanner is at
+unsigned long ksm_pages_scanned = 0; // Pages hashed by the merging scanner
+unsigned long ksm_bytes_compared = 0; // Bytes compared to confirm hash matches
+unsigned long ksm_merges = 0; // Pages merged with an identical page, each freeing a frame
+unsigned long ksm_zero_merges = 0; // All-zero pages merged into the zero frame, each freeing a frame
+unsigned long ksm_scan_usec = 0; // Microseconds spent scanning
 
 // Terminal related Data Structure
-LinkedList* inputBuffer[NUM_TERMINALS] = {NULL}; // Input buffer read for each terminal 
-int readReady[NUM_TERMINALS] = {0}; // Flag to indicate if terminal i has text available to read, -1 means not ready. 1 means ready.
+TtyInput inputRing[NUM_TERMINALS]; // Input received from terminal i and not read yet
 int writeReady[NUM_TERMINALS] = {0}; // Flag to indicate if terminal i is ready to be written, -1 means not ready. 1 means ready.
-LinkedList* readQueue[NUM_TERMINALS] = {NULL}; // Queue that stores the process's PCB for a read request on terminal i
-LinkedList* writeQueue[NUM_TERMINALS] = {NULL};// Queue that stores the process's PCB for a write request on terminal i
-PCB* transmitPCB[NUM_TERMINALS] = {NULL};
+PCBQueue readQueue[NUM_TERMINALS]; // Queue that stores the process's PCB for a read request on terminal i
+PCBQueue writeQueue[NUM_TERMINALS]; // Processes blocked in TtyWrite until terminal i's output ring drains
+TtyOutput outputRing[NUM_TERMINALS]; // Output written to terminal i and not transmitted yet
+unsigned long tty_writes = 0; // TtyWrite calls copied into an output ring
+unsigned long tty_transmits = 0; // TtyTransmit calls the output rings were drained with
+unsigned long tty_write_blocks = 0; // Times a writer blocked on a full output ring
 
 /* ######################## Global Variable ######################## */
 
@@ -58,34 +124,37 @@ PCB* transmitPCB[NUM_TERMINALS] = {NULL};
 void initKernel(void){
     TracePrintf(0, "Starting initKernel\n");
 
-    processQueue = CreateLinkedList();
-    runningQueue = CreateLinkedList();
-    delay_queue = CreateLinkedList();
-    wait_queue = CreateLinkedList();
+    delay_heap_capacity = DELAY_HEAP_INIT_CAPACITY;
+    delay_heap = (PCB **) malloc(delay_heap_capacity * sizeof(PCB *));
 
     // If we cannot initialize the kernel, we must halt this process.
-    if (processQueue == NULL || runningQueue == NULL || delay_queue == NULL || wait_queue == NULL) {
+    if (delay_heap == NULL) {
         TracePrintf(0, "Cannot initialize kernel; halting process.\n");
         printf("Cannot initialize kernel; halting process.\n");
         Halt();
     }
 
+    // Every process table slot starts free, handed out in order so idle gets pid 0 and init gets pid 1.
     int i;
+    for (i = 0; i < PROC_TABLE_SIZE; i++) {
+        proc_free_slots[i] = i;
+    }
+    proc_free_count = PROC_TABLE_SIZE;
+
     for (i = 0; i < NUM_TERMINALS; i++){
-        inputBuffer[i] = CreateLinkedList();
-        readQueue[i] = CreateLinkedList();
-        writeQueue[i] = CreateLinkedList();
-
-        // If we cannot initialize the kernel, we must halt this process.
-        if (inputBuffer[i] == NULL || readQueue[i] == NULL || writeQueue[i] == NULL) {
-            TracePrintf(0, "Cannot initialize kernel; halting process.\n");
-            printf("Cannot initialize kernel; halting process.\n");
-            Halt();
-        }
+        // Initially terminal[i] has nothing to read
+        inputRing[i].head = 0;
+        inputRing[i].count = 0;
+        inputRing[i].line_head = 0;
+        inputRing[i].lines = 0;
+        inputRing[i].wakeups = 0;
+        inputRing[i].dropped_lines = 0;
+        inputRing[i].dropped_bytes = 0;
 
-        readReady[i] = -1; // Initially terminal[i] is not ready to be read
         writeReady[i] = 1; // Initially terminal[i] is ready to write on
-        transmitPCB[i] = NULL;
+        outputRing[i].head = 0;
+        outputRing[i].count = 0;
+        outputRing[i].streamer = NULL;
     }
 
     TracePrintf(0, "Finished initKernel\n");
@@ -139,8 +208,11 @@ void InitMemoryManagement(unsigned int pmem_size)
     pgt_r0 = (struct pte*) malloc(PAGE_TABLE_SIZE);
     pgt_r1 = (struct pte*) malloc(PAGE_TABLE_SIZE);
 
+    // Reference count per frame for copy-on-write sharing. Left uninitialized: a frame's count is set when it is allocated.
+    frame_refcount = (unsigned int *) malloc((pmem_size >> PAGESHIFT) * sizeof(unsigned int));
+
     // If we cannot initialize the kernel, we must halt this process.
-    if (pgt_r0 == NULL || pgt_r1 == NULL) {
+    if (pgt_r0 == NULL || pgt_r1 == NULL || frame_refcount == NULL) {
         TracePrintf(0, "Cannot initialize kernel; halting process.\n");
         printf("Cannot initialize kernel; halting process.\n");
         Halt();
@@ -148,51 +220,25 @@ void InitMemoryManagement(unsigned int pmem_size)
 
     unsigned long i;    
 
-    // Fill in list structure for physical frames, and remove non-free frames in use by the kernel.
-    pframe *temp;
-    unsigned long frame_cnt = 0;
-
-    // Have to do it in 2 passes due to calling internal malloc.
-    for (i = PMEM_BASE; i < PMEM_BASE + pmem_size; i += PAGESIZE) {
-        if (i == PMEM_BASE) {
-            free_pframe_head = (pframe *) malloc(sizeof(pframe));
-
-            // If we cannot initialize the kernel, we must halt this process.
-            if (free_pframe_head == NULL) {
-                TracePrintf(0, "Cannot initialize kernel; halting process.\n");
-                printf("Cannot initialize kernel; halting process.\n");
-                Halt();
-            }
-
-            temp = free_pframe_head;
-            temp->frame_num = frame_cnt++;
-        } else {
-            temp->next = (pframe *) malloc(sizeof(pframe));
-
-            // If we cannot initialize the kernel, we must halt this process.
-            if (temp->next == NULL) {
-                TracePrintf(0, "Cannot initialize kernel; halting process.\n");
-                printf("Cannot initialize kernel; halting process.\n");
-                Halt();
-            }
-
-            temp = temp->next;
-            temp->frame_num = frame_cnt++;
-            free_pframe_count++;
-        }   
+    // Physical frames are handed out lazily: nothing is built per frame here. Every frame
+    // except the kernel stack and the region 1 kernel image (up to the current kernel_brk,
+    // so this must come after the mallocs above) starts out never-used, and AllocateFreePage
+    // takes them in order until freed frames come back on the free list.
+    num_pframes = pmem_size >> PAGESHIFT;
+    kernel_reserved_lo = KERNEL_STACK_BASE >> PAGESHIFT;
+    kernel_reserved_hi = UP_TO_PAGE((unsigned long) kernel_brk) >> PAGESHIFT;
+
+    next_untouched_pfn = PMEM_BASE >> PAGESHIFT;
+    if (next_untouched_pfn == kernel_reserved_lo) {
+        next_untouched_pfn = kernel_reserved_hi;
     }
 
-    temp = free_pframe_head;
-    pframe *temp2;
-    while (temp != NULL) {
-        if (temp->frame_num >= (KERNEL_STACK_BASE >> PAGESHIFT) && temp->frame_num < (((unsigned long) kernel_brk) >> PAGESHIFT) ) {
-            temp2 = temp;
-            temp = temp->next;
-            free(temp2);
-            free_pframe_count--;
-        } else {
-            temp = temp->next;
-        }
+    free_pframe_head = NO_FRAME;
+    free_pframe_count = num_pframes - (kernel_reserved_hi - kernel_reserved_lo);
+
+    // No frame is mapped in the kernel mapping slots yet.
+    for (i = 0; i < KMAP_SLOTS; i++) {
+        kmap_pfn[i] = NO_FRAME;
     }
 
     TracePrintf(0, "InitMemoryManagement: number of free frames is (%d)\n", free_pframe_count);
@@ -257,8 +303,9 @@ int SetKernelBrk(void *addr) {
         // After VM is enabled, allocate and map physical memory to the new break address
         // This part is more complex and involves interacting with the VM system
 
-        // First check if we have pages left to allocate memory.
-        if ((unsigned long) addr - UP_TO_PAGE((unsigned long) kernel_brk) > (unsigned long) (free_pframe_count << PAGESHIFT)) {
+        // First check if we have pages left to allocate memory, swapping out user pages if need be.
+        if ((unsigned long) addr > (unsigned long) kernel_brk
+            && EnsureFreeFrames((UP_TO_PAGE((unsigned long) addr) - UP_TO_PAGE((unsigned long) kernel_brk)) >> PAGESHIFT) == ERROR) {
             TracePrintf(0, "SetKernelBrk: after VM - not enough pages to allocate memory.\n");
             return -1;
         }
@@ -291,6 +338,7 @@ int SetKernelBrk(void *addr) {
 
                     // Return error if we have no more physical pages left.
                     if ((free_page_pfn = AllocateFreePage()) < 0) {
+                        TLBFlushPending();
                         return ERROR;
                     }
 
@@ -300,11 +348,13 @@ int SetKernelBrk(void *addr) {
                     pgt_r1[i].uprot = PROT_NONE;
                     pgt_r1[i].kprot = (PROT_READ | PROT_WRITE);
 
-                    // Must flush TBL for R1, since we mutated region 1.
-                    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_1);
+                    // Must flush TBL for this page, since we mutated region 1 (done once below).
+                    TLBInvalidate(VMEM_1_BASE + ((unsigned long) i << PAGESHIFT));
                 }
             }
 
+            TLBFlushPending();
+
             TracePrintf(0, "SetKernelBrk: set kernel break (after VM) to addr (0x%lx).\n", (unsigned long) addr);
 
             // Lastly, update the kernel_brk to new brk addr
@@ -333,8 +383,7 @@ CreateIdleProcess(ExceptionInfo *info, char **cmd_args)
     curr_proc = idle_pcb;
     LoadProgram("idle", cmd_args, info);
 
-    //enqueueToList(processQueue, idle_pcb);
-    //enqueueToList(runningQueue, idle_pcb);
+    //MakeProcessReady(idle_pcb);
     TracePrintf(0, "Successfully loaded in idle process.\n");
 }
 
@@ -347,7 +396,7 @@ CreateInitProcess(ExceptionInfo *info, char **cmd_args)
 
     // Create PCB structure for init process.
     struct PCB* init_pcb = CreatePCB(idle_pcb);
-    enqueueToList(idle_pcb->running_children, init_pcb);
+    addRunningChild(idle_pcb, init_pcb);
     TracePrintf(0, "Now creating init process with pid (%d).\n", init_pcb->pid);
 
     // Context switch from idle process to init process.
@@ -375,8 +424,6 @@ CreateInitProcess(ExceptionInfo *info, char **cmd_args)
         else {
             LoadProgram("init", cmd_args, info);
         }
-
-        enqueueToList(processQueue, curr_proc);
     }
 
     TracePrintf(0, "CreateInitProcess: at end.\n");
@@ -405,6 +452,22 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size, void *orig_brk, ch
     // Set flag for vm
     vm_enabled = 1;
 
+    // Set up the shared zero frame, which needs the kernel mapping slots and so VM.
+    InitZeroFrame();
+
+    // Open the swap file and empty the compressed store, so user pages can be put aside when the frames run out.
+    InitSwap();
+    InitZram();
+
+    // Nothing has been seen by the same-page merging scanner yet.
+    InitKsm();
+
+    // Kernel options come before the init program's name: -preload=prog1,prog2 warms the image cache.
+    while (cmd_args[0] != NULL && strncmp(cmd_args[0], "-preload=", strlen("-preload=")) == 0) {
+        PreloadImageCache(cmd_args[0] + strlen("-preload="));
+        cmd_args++;
+    }
+
     // Create the idle process, which should run when no other processes are ready
     CreateIdleProcess(info, cmd_args);
 
@@ -413,6 +476,59 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size, void *orig_brk, ch
 
 }
 
+/*
+ * Halts the kernel once every process but idle has exited and every terminal
+ * has sent all of its output. TtyWrite returns before its bytes reach the
+ * terminal, so this is called when the last process exits and again as each
+ * transmit completes; until then idle keeps running.
+ */
+void HaltIfFinished() {
+    if (proc_table_count != 1) {
+        return;
+    }
+
+    int tty;
+    for (tty = 0; tty < NUM_TERMINALS; tty++) {
+        if (outputRing[tty].count > 0 || writeReady[tty] != 1) {
+            TracePrintf(0, "HaltIfFinished: terminal (%d) still has output to send, not halting yet.\n", tty);
+            return;
+        }
+    }
+
+    printf("All processes (except idle) have been exited. Now Halting the kernel.\n");
+    PrintKernelStats();
+    Halt();
+}
+
+/* Prints the kernel's performance counters, just before halting. */
+void PrintKernelStats() {
+    printf("Image cache: %lu hits, %lu misses, %d programs cached (%lu bytes).\n",
+        image_cache_hits, image_cache_misses, image_cache_count, image_cache_bytes);
+    printf("Zeroed frame pool: %lu hits, %lu misses, %d of %d frames ready.\n",
+        zero_pool_hits, zero_pool_misses, zero_pool_count, ZERO_POOL_SIZE);
+    printf("TLB: %lu pages invalidated, %lu address flushes, %lu region flushes, %lu flushes avoided.\n",
+        tlb_pages_invalidated, tlb_address_flushes, tlb_region_flushes, tlb_flushes_avoided);
+    printf("Kernel mapping slots: %lu hits, %lu misses.\n", kmap_hits, kmap_misses);
+    printf("Swap: %lu pages out, %lu pages in, %lu rescued by the clock, %d of %d slots in use.\n",
+        swap_outs, swap_ins, swap_rescues, swap_slots_used, SWAP_SLOTS);
+    printf("Compressed store: %lu pages compressed, %lu rejected, %d held in %d frames (%lu bytes, %lu%% of original).\n",
+        zram_stores, zram_rejected, zram_stored_pages, zram_pool_count, zram_stored_bytes,
+        zram_stored_pages ? zram_stored_bytes * 100 / ((unsigned long) zram_stored_pages * PAGESIZE) : 0);
+    printf("Fault latency: %lu decompressions averaging %lu us, %lu swap-ins averaging %lu us.\n",
+        zram_loads, zram_loads ? zram_load_usec / zram_loads : 0, swap_ins, swap_ins ? swap_in_usec / swap_ins : 0);
+    printf("Terminal output: %lu writes sent in %lu transmits, %lu writer blocks on a full ring.\n",
+        tty_writes, tty_transmits, tty_write_blocks);
+    unsigned long dropped_lines = 0, dropped_bytes = 0;
+    int tty;
+    for (tty = 0; tty < NUM_TERMINALS; tty++) {
+        dropped_lines += inputRing[tty].dropped_lines;
+        dropped_bytes += inputRing[tty].dropped_bytes;
+    }
+    printf("Terminal input: %lu lines (%lu bytes) dropped on a full ring.\n", dropped_lines, dropped_bytes);
+    printf("Same-page merging: %lu frames saved (%lu merged, %lu zero), %lu pages scanned, %lu bytes compared, %lu us.\n",
+        ksm_merges + ksm_zero_merges, ksm_merges, ksm_zero_merges, ksm_pages_scanned, ksm_bytes_compared, ksm_scan_usec);
+}
+
 /* 
  * Helper function to context switch. p1 is current process; p2
  * is process that we want to switch to.
@@ -432,12 +548,29 @@ SavedContext
     // Cases for if we need to copy only kernel stack and saved context. Fork or init/idle.
     if (pcb1->needs_copy == 1) {
         TracePrintf(0, "MySwitchFunc copying over kernel stack and saved context\n");
-        // Now, we need to copy kernel stack.
-        // First set up unused pte to copy into.
-        unsigned long pte_for_copy_pfn = USER_STACK_LIMIT >> PAGESHIFT;
-
-        // Next, loop through everything region 0 kernel stack in p1.
+        // Now, we need to copy kernel stack, frame to frame through the kernel mapping slots.
+        // Loop through everything region 0 kernel stack in p1.
         unsigned long page_num;
+
+        // Take a frame for each valid kernel stack page before changing anything. If one cannot be had, give back
+        // the ones taken and return to p1 with needs_copy 0; the caller then tears p2 down and fails.
+        long frames[KERNEL_STACK_PAGES];
+        int nframes = 0;
+        for (i = KERNEL_STACK_BASE; i < KERNEL_STACK_LIMIT; i += PAGESIZE) {
+            if (pcb1->pgt_r0[i >> PAGESHIFT].valid == 1) {
+                if ((frames[nframes] = AllocateFreePage()) < 0) {
+                    TracePrintf(0, "MySwitchFunc: no free frame for the kernel stack of process (%d).\n", pcb2->pid);
+                    while (nframes > 0) {
+                        FreePhysicalPage((unsigned int) frames[--nframes]);
+                    }
+                    pcb1->needs_copy = 0;
+                    return (pcb1->ctx);
+                }
+                nframes++;
+            }
+        }
+
+        nframes = 0;
         for (i = KERNEL_STACK_BASE; i < KERNEL_STACK_LIMIT; i += PAGESIZE) {
             page_num = i >> PAGESHIFT;
 
@@ -445,24 +578,16 @@ SavedContext
             pcb2->pgt_r0[page_num].valid = pcb1->pgt_r0[page_num].valid;
 
             // If valid, we need to copy over.
-            if (pcb1->pgt_r0[page_num].valid == 1 && page_num != pte_for_copy_pfn) {
+            if (pcb1->pgt_r0[page_num].valid == 1) {
                 TracePrintf(0, "Now copying over idx (%d) at addr (0x%lx).\n", page_num, i);
 
-                pcb1->pgt_r0[pte_for_copy_pfn].valid = 1;
-                pcb1->pgt_r0[pte_for_copy_pfn].uprot = PROT_ALL;
-                pcb1->pgt_r0[pte_for_copy_pfn].kprot = PROT_ALL;
-
-                // Allocate free page. Set transfer pte with same pfn.
-                pcb2->pgt_r0[page_num].pfn = AllocateFreePage();
-                pcb1->pgt_r0[pte_for_copy_pfn].pfn = pcb2->pgt_r0[page_num].pfn;
+                // Use the next of the frames taken above.
+                pcb2->pgt_r0[page_num].pfn = (unsigned int) frames[nframes++];
 
                 TracePrintf(0, "Allocated pfn (%d) for copying kernel stack\n", pcb2->pgt_r0[page_num].pfn);
 
-                // TLB Flush region 0 page table as we mutate it.
-                WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
-
                 // Copy memory from page in curr_proc to corresponding page in child_proc.
-                memcpy((void *) (pte_for_copy_pfn << PAGESHIFT), (void *) (i), PAGESIZE);
+                CopyFrame(pcb2->pgt_r0[page_num].pfn, pcb1->pgt_r0[page_num].pfn);
 
                 TracePrintf(0, "Valid bit at idx (%d) for pcb2 is (%d).\n", page_num, pcb2->pgt_r0[page_num].valid);
 
@@ -474,12 +599,6 @@ SavedContext
 
         TracePrintf(0, "Finished copying over.\n");
         
-        // Don't forget to set to invalid.
-        pcb1->pgt_r0[pte_for_copy_pfn].valid = 0;
-
-        // TLB Flush region 0 page table as we mutate it.
-        WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
-
         // A trace print to help.
         TracePrintf(0, "Pcb2 page table is at physical address (0x%lx).\n", pcb2->pgt_r0_paddr);
 
@@ -488,7 +607,7 @@ SavedContext
 
         TracePrintf(0, "Flushing TLB.\n");
 
-        WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+        TLBFlushRegion(0);
 
         TracePrintf(0, "Done flushing TLB.\n");
 
@@ -500,46 +619,55 @@ SavedContext
 
         // Set running process as p2 and return its ctx.
         curr_proc = pcb2;
+        pcb2->state = PROC_RUNNING;
 
         TracePrintf(0, "Done Context Switch.\n");
 
         return (pcb2->ctx);
     } 
     // Case for when p1 is terminated.
-    else if (pcb1->isTerminated == 1) {
+    else if (pcb1->state == PROC_TERMINATED) {
         TracePrintf(0, "MySwitchFunc terminating process\n");
 
         // First, deallocate every physical frame that was used in region 0 mem.
-        for (i = MEM_INVALID_PAGES; i < PAGE_TABLE_LEN; i++) {
+        // Only pages marked in use hold anything; swapped-out pages give back their swap slots.
+        for (i = NextUsedPage(pcb1, 0); i < USER_PAGES; i = NextUsedPage(pcb1, i + 1)) {
+            ReleaseUserPage(pcb1, i);
+        }
+        for (i = USER_PAGES; i < PAGE_TABLE_LEN; i++) {
             if (pcb1->pgt_r0[i].valid == 1) {
                 FreePhysicalPage(pcb1->pgt_r0[i].pfn);
                 pcb1->pgt_r0[i].valid = 0;
             }
         }
 
-        // Remove terminated PCB from process queue.
-        if (SearchAndRemovePCB(processQueue, pcb1->pid) == ERROR) {
-            TracePrintf(0, "Could not succesfully remove PCB from process queue\n");
-        }
+        // Drop the process's use of its program file.
+        ReleaseProgramImage(pcb1->image);
+
+        // Remove terminated PCB from process table.
+        RemoveProcess(pcb1);
 
-        // Before we write to register, if we are terminating the last process, we don't write to register.
-        if (pcb2 == idle_pcb && IsLinkedListEmpty(processQueue) == 1) {
-            printf("All processes (except idle) have been exited. Now Halting the kernel.\n");
-            Halt(); // Instesad, we Halt to stop execution.
+        // Before we write to register, if we are terminating the last process (only idle is left), we Halt instead,
+        // unless a terminal is still sending output; then idle runs and TrapTransmitHandler halts after the last transmit.
+        if (pcb2 == idle_pcb) {
+            HaltIfFinished();
         }
 
         // Rewrite new page table into register. Flush TLB for region 0.
         WriteRegister(REG_PTR0, (RCS421RegVal) (pcb2->pgt_r0_paddr));
-        WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+        TLBFlushRegion(0);
+
+        // The hardware no longer uses process 1's page table, so give it back to the pool.
+        FreeRegion0PageTable(pcb1);
 
         // Free the rest of PCB for process 1.
-        freeListContents(pcb1->running_children);
         freeListContentsExitChildren(pcb1->exited_children);
         free(pcb1->ctx);
         free(pcb1);
 
         // Set running process as p2 and return its ctx.
         curr_proc = pcb2;
+        pcb2->state = PROC_RUNNING;
 
         TracePrintf(0, "Done Context Switch.\n");
 
@@ -549,10 +677,11 @@ SavedContext
     TracePrintf(0, "MySwitchFunc performing 'normal' context switch\n");
     
     WriteRegister(REG_PTR0, (RCS421RegVal) (pcb2->pgt_r0_paddr));
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+    TLBFlushRegion(0);
 
     // Set running process as p2 and return its ctx.
     curr_proc = pcb2;
+    pcb2->state = PROC_RUNNING;
 
     TracePrintf(0, "Done Context Switch.\n");
 
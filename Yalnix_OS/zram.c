@@ -0,0 +1,283 @@
+#include "function.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include </clear/courses/comp421/pub/include/comp421/yalnix.h>
+#include </clear/courses/comp421/pub/include/comp421/hardware.h>
+#include </clear/courses/comp421/pub/include/comp421/loadinfo.h>
+
+// Where CompressPage puts a page before it is known to be worth storing.
+static char zram_scratch[ZRAM_MAX_LEN];
+
+/*
+ * Marks every pool frame of the compressed store unused.
+ */
+void InitZram() {
+    int frame;
+    for (frame = 0; frame < ZRAM_POOL_FRAMES; frame++) {
+        zram_pool[frame].pfn = NO_FRAME;
+    }
+}
+
+/*
+ * Compresses the page at src into dst, which holds cap bytes. Runs of three
+ * or more equal bytes become a count byte of 128 or more (run length + 125)
+ * followed by the byte; anything else is copied as a count byte below 128
+ * (literal length - 1) followed by up to 128 bytes. Returns the compressed
+ * length, or -1 if it does not fit in cap bytes.
+ */
+int CompressPage(const unsigned char *src, unsigned char *dst, int cap) {
+    int in = 0;
+    int out = 0;
+
+    while (in < PAGESIZE) {
+        // Measure the run of equal bytes starting here.
+        int run = 1;
+        while (in + run < PAGESIZE && run < 130 && src[in + run] == src[in]) {
+            run++;
+        }
+
+        if (run >= 3) {
+            if (out + 2 > cap) {
+                return (-1);
+            }
+            dst[out++] = (unsigned char) (run + 125);
+            dst[out++] = src[in];
+            in += run;
+            continue;
+        }
+
+        // Copy literals up to the next run of three (or 128 bytes).
+        int lit = 0;
+        while (in + lit < PAGESIZE && lit < 128
+               && !(in + lit + 2 < PAGESIZE && src[in + lit] == src[in + lit + 1] && src[in + lit] == src[in + lit + 2])) {
+            lit++;
+        }
+
+        if (out + 1 + lit > cap) {
+            return (-1);
+        }
+        dst[out++] = (unsigned char) (lit - 1);
+        memcpy(dst + out, src + in, lit);
+        out += lit;
+        in += lit;
+    }
+
+    return out;
+}
+
+/*
+ * Expands len bytes written by CompressPage at src into the page at dst.
+ */
+void DecompressPage(const unsigned char *src, int len, unsigned char *dst) {
+    int in = 0;
+    int out = 0;
+
+    while (in < len) {
+        int c = src[in++];
+        if (c >= 128) {
+            memset(dst + out, src[in++], c - 125);
+            out += c - 125;
+        } else {
+            memcpy(dst + out, src + in, c + 1);
+            in += c + 1;
+            out += c + 1;
+        }
+    }
+}
+
+/*
+ * Compresses resident page vpn of pcb into the compressed store and frees
+ * its frame. The page must be private (frame reference count 1). Compressed
+ * pages are packed one after another into pool frames; if none has room,
+ * the page's own frame becomes a new pool frame, so storing a page never
+ * needs a free frame. Returns 1 if a frame was freed, 0 if the page was
+ * stored in its own frame, ERROR if it does not compress to ZRAM_MAX_LEN
+ * bytes or the store is full.
+ */
+int ZramStorePage(PCB *pcb, unsigned long vpn) {
+    struct pte *pte = &pcb->pgt_r0[vpn];
+
+    char *page = (char *) KMap(pte->pfn);
+    int len = CompressPage((unsigned char *) page, (unsigned char *) zram_scratch, ZRAM_MAX_LEN);
+    KUnmap(page);
+
+    if (len < 0) {
+        zram_rejected++;
+        return ERROR;
+    }
+
+    int entry;
+    for (entry = 0; entry < ZRAM_MAX_ENTRIES && zram_entries[entry].refcount != 0; entry++) {
+        continue;
+    }
+
+    // Take the pool frame with the least room that still fits the page.
+    int frame;
+    int best = -1;
+    int free_slot = -1;
+    for (frame = 0; frame < ZRAM_POOL_FRAMES; frame++) {
+        if (zram_pool[frame].pfn == NO_FRAME) {
+            if (free_slot < 0) {
+                free_slot = frame;
+            }
+        } else if (PAGESIZE - zram_pool[frame].used >= len
+                   && (best < 0 || zram_pool[frame].used > zram_pool[best].used)) {
+            best = frame;
+        }
+    }
+
+    if (entry == ZRAM_MAX_ENTRIES || (best < 0 && free_slot < 0)) {
+        TracePrintf(0, "ZramStorePage: compressed store is full.\n");
+        return ERROR;
+    }
+
+    int freed = 1;
+    if (best < 0) {
+        // The page's frame holds the compressed copy of itself, and later pages after it.
+        best = free_slot;
+        zram_pool[best].pfn = pte->pfn;
+        zram_pool[best].used = 0;
+        zram_pool[best].live = 0;
+        zram_pool_count++;
+        freed = 0;
+    }
+
+    char *pool = (char *) KMap((unsigned long) zram_pool[best].pfn);
+    memcpy(pool + zram_pool[best].used, zram_scratch, len);
+    KUnmap(pool);
+
+    zram_entries[entry].frame = best;
+    zram_entries[entry].offset = zram_pool[best].used;
+    zram_entries[entry].len = len;
+    zram_entries[entry].refcount = 1;
+    zram_pool[best].used += len;
+    zram_pool[best].live++;
+
+    if (freed) {
+        FreePhysicalPage(pte->pfn);
+    }
+    pte->pfn = (unsigned int) entry;
+    pte->unused = (pte->unused & ~PTE_UNREF) | PTE_ZRAM;
+    pte->valid = 0;
+    pcb->resident_pages--;
+
+    zram_stores++;
+    zram_stored_pages++;
+    zram_stored_bytes += len;
+
+    return freed;
+}
+
+/*
+ * Under memory pressure, compresses pages of processes that have been
+ * blocked in Wait or TtyRead for at least ZRAM_IDLE_TICKS clock ticks, such
+ * as shells waiting for input; they are unlikely to need them soon. Takes
+ * private resident pages only, up to SWAP_BATCH freed frames. Returns the
+ * number of frames freed.
+ */
+int ZramCompressIdle() {
+    int freed = 0;
+    int slot;
+
+    for (slot = 0; slot < PROC_TABLE_SIZE && freed < SWAP_BATCH; slot++) {
+        PCB *pcb = proc_table[slot];
+        if (pcb == NULL || pcb == curr_proc || (pcb->state != PROC_WAITING && pcb->state != PROC_READING)
+            || total_runningTime - pcb->blocked_since < ZRAM_IDLE_TICKS) {
+            continue;
+        }
+
+        unsigned long vpn;
+        for (vpn = NextUsedPage(pcb, 0); vpn < USER_PAGES && freed < SWAP_BATCH; vpn = NextUsedPage(pcb, vpn + 1)) {
+            struct pte *pte = &pcb->pgt_r0[vpn];
+            if ((pte->valid == 1 || (pte->unused & PTE_UNREF))
+                && (long) pte->pfn != zero_pfn && frame_refcount[pte->pfn] == 1) {
+                if (ZramStorePage(pcb, vpn) > 0) {
+                    freed++;
+                }
+            }
+        }
+    }
+
+    // A blocked process is not running, so its pages have no TLB entries to flush.
+    TracePrintf(0, "ZramCompressIdle: freed (%d) frames, store holds (%d) pages in (%d) frames.\n",
+        freed, zram_stored_pages, zram_pool_count);
+
+    return freed;
+}
+
+/*
+ * Adds a reference to a compressed page that another page table entry now
+ * refers to as well, e.g. the child's copy after Fork.
+ */
+void ShareZramEntry(unsigned int entry) {
+    zram_entries[entry].refcount++;
+}
+
+/*
+ * Drops one reference to a compressed page. The last one removes it from
+ * its pool frame, and the pool frame is freed once nothing in it is live.
+ */
+void FreeZramEntry(unsigned int entry) {
+    if (--zram_entries[entry].refcount > 0) {
+        return;
+    }
+
+    int frame = zram_entries[entry].frame;
+    zram_stored_pages--;
+    zram_stored_bytes -= zram_entries[entry].len;
+
+    if (--zram_pool[frame].live == 0) {
+        FreePhysicalPage((unsigned int) zram_pool[frame].pfn);
+        zram_pool[frame].pfn = NO_FRAME;
+        zram_pool_count--;
+    }
+}
+
+/*
+ * Decompresses region 0 page vpn of the current process, tagged PTE_ZRAM,
+ * into a new frame and makes it valid with the protections it had. The
+ * time it takes is added to the fault latency counters. Returns 0 on
+ * success, ERROR if there is no frame for it.
+ */
+int ZramLoadPage(unsigned long vpn) {
+    struct pte *pte = &curr_proc->pgt_r0[vpn];
+    unsigned int entry = pte->pfn;
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+
+    long pfn;
+    if ((pfn = AllocateFreePage()) < 0) {
+        TracePrintf(0, "ZramLoadPage: no free frame for page (%d).\n", vpn);
+        return ERROR;
+    }
+
+    char *pool = (char *) KMap((unsigned long) zram_pool[zram_entries[entry].frame].pfn);
+    char *page = (char *) KMap((unsigned long) pfn);
+    DecompressPage((unsigned char *) pool + zram_entries[entry].offset, zram_entries[entry].len, (unsigned char *) page);
+    KUnmap(page);
+    KUnmap(pool);
+
+    FreeZramEntry(entry);
+
+    pte->pfn = (unsigned int) pfn;
+    pte->unused &= ~PTE_ZRAM;
+    pte->valid = 1;
+    curr_proc->resident_pages++;
+
+    TLBFlushAddress(vpn << PAGESHIFT);
+
+    gettimeofday(&end, NULL);
+    zram_loads++;
+    zram_load_usec += (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+
+    TracePrintf(0, "ZramLoadPage: decompressed entry (%d) into pfn (%d) at page (%d) for process (%d).\n", entry, pfn, vpn, curr_proc->pid);
+
+    return 0;
+}